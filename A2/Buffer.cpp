@@ -0,0 +1,50 @@
+#include "Buffer.h"
+#include "FileWriter.h"
+#include "ListBuffer.h"
+#include "PieceTable.h"
+#include "SharedBuffer.h"
+
+Buffer* Buffer::create(BufferType type) {
+    switch (type) {
+        case LIST_BUFFER:
+            return new ListBuffer();
+        case SHARED_BUFFER:
+            // with a store of its own: LineEditor shares one between its files.
+            return new SharedBuffer(make_shared<LineStore>());
+        case WINDOWED_BUFFER:
+            return new PieceTable(PieceTable::WINDOW_BLOCKS);
+        case PIECE_TABLE_BUFFER:
+        default:
+            return new PieceTable();
+    }
+}
+
+void Buffer::write_to(FileWriter& writer) const {
+    for_each(0, size(), [&writer](const char* data, size_t length) {
+        writer.append_line(data, length);
+    });
+}
+
+void Buffer::move_lines(const size_t from, const size_t to, const size_t index) {
+    if (index >= from && index <= to) {
+        return;
+    }
+    const unique_ptr<Lines> lines = cut(from, to);
+    insert(index > to ? index - (to - from) : index, *lines);
+}
+
+void Buffer::copy_lines(const size_t from, const size_t to, const size_t index) {
+    insert(index, *copy(from, to));
+}
+
+size_t Buffer::invalid_lines(size_t& first) const {
+    return 0;
+}
+
+bool Buffer::truncated() {
+    return false;
+}
+
+unique_ptr<Buffer> Buffer::snapshot() const {
+    return nullptr;
+}
@@ -0,0 +1,157 @@
+#ifndef Buffer_h
+#define Buffer_h
+
+#include <functional>
+#include <memory>
+#include <string>
+#include "LineBatch.h"
+
+using namespace std;
+
+class FileWriter;
+
+/**
+ * The available buffer engines.
+ */
+enum BufferType {
+    LIST_BUFFER,
+    PIECE_TABLE_BUFFER,
+    SHARED_BUFFER,
+    WINDOWED_BUFFER
+};
+
+/**
+ * Interface for the storage holding the lines being edited.
+ * All indices are zero-based and ranges are half-open: [from, to).
+ * Callers are responsible for passing valid indices.
+ */
+class Buffer {
+public:
+    /**
+     * Called once per line by for_each with a pointer to the line's
+     * bytes and its length. The pointer stays valid until the buffer
+     * is modified.
+     */
+    typedef function<void(const char* data, size_t length)> LineVisitor;
+
+    /**
+     * Lines taken out of a buffer, held in whatever form is the
+     * cheapest for the engine, that can be inserted back later.
+     * Only the buffer that created them can use them.
+     */
+    class Lines {
+    public:
+        virtual ~Lines()=default;
+
+        virtual size_t size() const=0;
+
+        /**
+         * Approximate number of bytes used to hold the lines.
+         */
+        virtual size_t memory() const=0;
+    };
+
+    virtual ~Buffer()=default;
+
+    /**
+     * Creates an empty buffer of the given type.
+     */
+    static Buffer* create(BufferType type);
+
+    /**
+     * Replaces the content of the buffer with the lines of the given file.
+     * Returns false if the file could not be opened.
+     */
+    virtual bool load(const string& filename)=0;
+
+    /**
+     * Number of lines of the file last loaded that are not valid UTF-8,
+     * found while loading it. When there is any, first is set to the
+     * index of the first one. Engines that don't check return 0, the default.
+     */
+    virtual size_t invalid_lines(size_t& first) const;
+
+    /**
+     * Whether the file the buffer still reads lines from was truncated
+     * since the last call, losing some of them: they then read as zeros
+     * rather than faulting. Engines holding their own copy of the lines
+     * return false, the default.
+     */
+    virtual bool truncated();
+
+    /**
+     * Number of lines in the buffer.
+     */
+    virtual size_t size() const=0;
+
+    /**
+     * Returns a copy of the line at the given index.
+     */
+    virtual string line(const size_t index) const=0;
+
+    /**
+     * Calls the visitor on every line in [from, to), in order.
+     */
+    virtual void for_each(const size_t from, const size_t to, const LineVisitor& visitor) const=0;
+
+    /**
+     * Inserts the lines before the given index.
+     * An index equal to size() appends at the end.
+     */
+    virtual void insert(const size_t index, const LineBatch& lines)=0;
+
+    /**
+     * Replaces the content of the line at the given index.
+     */
+    virtual void replace(const size_t index, const string& line)=0;
+
+    /**
+     * Removes the lines in [from, to).
+     */
+    virtual void erase(const size_t from, const size_t to)=0;
+
+    /**
+     * Returns the lines in [from, to).
+     */
+    virtual unique_ptr<Lines> copy(const size_t from, const size_t to) const=0;
+
+    /**
+     * Removes the lines in [from, to) and returns them.
+     */
+    virtual unique_ptr<Lines> cut(const size_t from, const size_t to)=0;
+
+    /**
+     * Inserts lines returned by copy or cut before the given index.
+     */
+    virtual void insert(const size_t index, const Lines& lines)=0;
+
+    /**
+     * Moves the lines in [from, to) before the line at index (given
+     * before the move; size() moves them to the end). An index within
+     * [from, to] leaves them where they are. The text of the lines is
+     * not copied: by default they are cut and inserted back.
+     */
+    virtual void move_lines(const size_t from, const size_t to, const size_t index);
+
+    /**
+     * Inserts a copy of the lines in [from, to) before the line at index.
+     * By default the lines are copied and inserted: the engines sharing
+     * the text of their copies only duplicate what refers to it.
+     */
+    virtual void copy_lines(const size_t from, const size_t to, const size_t index);
+
+    /**
+     * Appends every line, each followed by a newline, to the writer.
+     */
+    virtual void write_to(FileWriter& writer) const;
+
+    /**
+     * A copy of the buffer as it is now, that can be read (and written
+     * to a file) from another thread while this one goes on changing.
+     * Engines that can't make one in about the time of a command return
+     * nullptr, which is the default.
+     */
+    virtual unique_ptr<Buffer> snapshot() const;
+};
+
+#endif /* Buffer_h */
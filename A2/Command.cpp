@@ -1,124 +1,393 @@
-#include <regex>
 #include <iostream>
+#include <climits>
+#include <cstring>
 #include "Command.h"
+#include "Stats.h"
+#include "StringSearcher.h"
 
 //using namespace std;
 
+namespace {
+
+/**
+ * Reads a command one character at a time, skipping spaces and tabs
+ * anywhere in the input (so "1, 2 p" reads like "1,2p").
+ * Works on the input string directly without copying it.
+ */
+class Lexer {
+private:
+    const char* _position;
+    const char* const _end;
+
+    void skip_blanks() {
+        while (_position != _end && (*_position == ' ' || *_position == '\t'))
+            ++_position;
+    }
+
+public:
+    Lexer(const string& input) : _position(input.data()), _end(input.data() + input.size()) {
+        skip_blanks();
+    }
+
+    bool at_end() const {
+        return _position == _end;
+    }
+
+    /**
+     * Returns the current character, or '\0' at the end.
+     */
+    char peek() const {
+        return at_end() ? '\0' : *_position;
+    }
+
+    void advance() {
+        ++_position;
+        skip_blanks();
+    }
+
+    /**
+     * Moves past the current character if it is one of the given ones
+     * and stores it in found.
+     */
+    bool accept_one_of(const char* characters, char& found) {
+        for (; !at_end() && *characters; ++characters) {
+            if (*_position == *characters) {
+                found = *characters;
+                advance();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool accept(char character) {
+        char found;
+        const char characters[] = { character, '\0' };
+        return accept_one_of(characters, found);
+    }
+
+    /**
+     * Takes the current character as a delimiter and reads the text up
+     * to the next one, as is (blanks included), moving past both.
+     * "\\" followed by the delimiter stands for the delimiter itself.
+     * Returns false if the closing delimiter is missing.
+     */
+    bool read_delimited(string& text) {
+        const char delimiter = *_position++;
+        text.clear();
+        for (; _position != _end; ++_position) {
+            if (*_position == delimiter) {
+                advance();
+                return true;
+            }
+            if (*_position == '\\' && _position + 1 != _end && _position[1] == delimiter)
+                ++_position;
+            text.push_back(*_position);
+        }
+        return false;
+    }
+
+    /**
+     * Whether the text left is the given one, followed by blanks only.
+     */
+    bool rest_is(const char* text) const {
+        const size_t length = strlen(text);
+        if (static_cast<size_t>(_end - _position) < length || memcmp(_position, text, length) != 0)
+            return false;
+        for (const char* rest = _position + length; rest != _end; ++rest) {
+            if (*rest != ' ' && *rest != '\t')
+                return false;
+        }
+        return true;
+    }
+
+    bool at_digit() const {
+        return !at_end() && *_position >= '0' && *_position <= '9';
+    }
+
+    /**
+     * Reads a run of digits. Sets overflow if the number doesn't fit.
+     */
+    size_t read_number(bool& overflow) {
+        size_t value(0);
+        overflow = false;
+        while (at_digit()) {
+            const size_t digit = *_position - '0';
+            if (value > (ULONG_MAX - digit) / 10)
+                overflow = true;
+            value = value * 10 + digit;
+            advance();
+        }
+        return value;
+    }
+};
+
+/**
+ * A line address: a number, '.' (current line) or '$' (last line).
+ */
+struct Address {
+    enum Kind { NONE, NUMBER, MARKER } kind;
+    size_t value;
+    Command::Reference reference;
+    bool overflow;
+
+    Address() : kind(NONE), value(0), reference(Command::ABSOLUTE), overflow(false) { }
+};
+
+/**
+ * Reads an address if there is one at the current position.
+ */
+Address read_address(Lexer& lexer) {
+    Address address;
+    if (lexer.at_digit()) {
+        address.kind = Address::NUMBER;
+        address.value = lexer.read_number(address.overflow);
+    } else if (lexer.accept('.')) {
+        address.kind = Address::MARKER;
+        address.reference = Command::CURRENT_LINE;
+    } else if (lexer.accept('$')) {
+        address.kind = Address::MARKER;
+        address.reference = Command::LAST_LINE;
+    }
+    return address;
+}
+
+/**
+ * Reads the address following 't' (copy) or 'm' (move), which they
+ * can't do without. Other commands take none: destination is left empty.
+ */
+bool read_destination(Lexer& lexer, const char command, Address& destination) {
+    if (command != 't' && command != 'm')
+        return true;
+    destination = read_address(lexer);
+    return destination.kind != Address::NONE;
+}
+
+/**
+ * Stores the address in the given value and reference fields.
+ * Returns false if the number was too big.
+ */
+bool assign(size_t& field, Command::Reference& reference, const Address& address) {
+    if (address.overflow)
+        return false;
+    field = address.value;
+    reference = address.reference;
+    return true;
+}
+
+}
+
 Command::Command(const size_t current_line, const size_t last_line) : _current_line(current_line),
-    _last_line(last_line), _line_number(1), _range_start(1), _range_end(1), _type(INVALID) { }
+    _last_line(last_line), _line_number(1), _range_start(1), _range_end(1), _destination(0),
+    _range_start_reference(ABSOLUTE), _range_end_reference(ABSOLUTE), _destination_reference(ABSOLUTE), _type(INVALID),
+    _global_type(INVALID), _inverted(false) { }
 
 bool Command::parse(const string& input) {
-    // remove all spaces and tabs.
-    string sanitized(input);
-    replace_all(sanitized, " ", "");
-    replace_all(sanitized, "\t", "");
-    
-    if (sanitized.size() == 0) { // empty string.
+    Stats::Timer timer(Stats::PARSE);
+    if (!parse_command(input))
+        return false;
+    rebind(_current_line, _last_line);
+    return true;
+}
+
+void Command::rebind(const size_t current_line, const size_t last_line) {
+    _current_line = current_line;
+    _last_line = last_line;
+    if (_range_start_reference != ABSOLUTE)
+        _range_start = (_range_start_reference == CURRENT_LINE) ? _current_line : _last_line;
+    if (_range_end_reference != ABSOLUTE)
+        _range_end = (_range_end_reference == CURRENT_LINE) ? _current_line : _last_line;
+    if (_destination_reference != ABSOLUTE)
+        _destination = (_destination_reference == CURRENT_LINE) ? _current_line : _last_line;
+}
+
+bool Command::parse_command(const string& input) {
+    Lexer lexer(input);
+
+    if (lexer.at_end()) { // empty string.
         _type = MOVE_DOWN;
         _line_number = 1;
         return true;
     }
 
+    if (parse_search(input) || parse_global(input) || parse_named(input))
+        return _type != INVALID;
+
     // Parsing is simple if it's a single character.
     // Since parse_single_character doesn't recognize digits,
-    // we let the regular expression handle it after.
-    if (sanitized.size() == 1 && parse_single_character(sanitized[0]))
-        return true;
-    
-    // use regex for the more complicated commands:
-    regex pattern("^(?:"
-                  //group 1 - capture 2 and 3.
-                  "(([0-9]+),?[0-9]*([u|d]))|"
-                  // group 4 - capture 5, 6, 7
-                  "(([0-9]+|\\.|\\$),([0-9]+|\\.|\\$)([r|p|c|n]))|"
-                  // group 8 - capture 9, 10
-                  "(([0-9]+|\\.|\\$)([r|p|c|n]))|"
-                  // group 11 - capture 12, 13
-                  "(,([0-9]+|\\.|\\$)([r|p|c|n]))|"
-                  // group 14 - capture 15, 16
-                  "(([0-9]+|\\.|\\$),([r|p|c|n]))|"
-                  // group 17 - capture 18, 19
-                  "(([0-9]+|\\.|\\$),([0-9]+|\\.|\\$))|"
-                  // group 20 - capture 21
-                  "(([0-9]+))|"
-                  // group 22, capture 23
-                  "(([0-9]+|\\.|\\$),)|"
-                  // group 24, capture 25, 26
-                  "(([0-9]+|\\.|\\$),?[0-9]*([a|i|]))" // command like 1,1a or 5a or $a
-                  ")$");
-    smatch result;
-    regex_match(sanitized, result, pattern);
-
-    // if a valid command was issued, it will match one of the groups
-    // described in the regular expression.
-    if (result.size() > 0) {
-        if (result.str(1).size() > 0) {
-            // group 1
-            _type = get_type_from_character(result.str(3));
-            _line_number = get_numerical_value(result.str(2));
-        } else if (result.str(4).size() > 0) {
-            // group 4
-            _type = get_type_from_character(result.str(7));
-            _range_start = get_numerical_value(result.str(5));
-            _range_end = get_numerical_value(result.str(6));
-        } else if (result.str(8).size()>0) {
-            // group 8
-            _type = get_type_from_character(result.str(10));
-            _range_start = get_numerical_value(result.str(9));
-            _range_end = _range_start;
-        } else if (result.str(11).size() > 0) {
-            // group 11
-            _type = get_type_from_character(result.str(13));
-            _range_start = _current_line;
-            _range_end = get_numerical_value(result.str(12));
-        } else if (result.str(14).size() > 0) {
-            // group 14
-            _type = get_type_from_character(result.str(16));
-            _range_start = get_numerical_value(result.str(15));
-            _range_end = _current_line;
-        } else if (result.str(17).size() > 0) {
-            // group 17
-            _type = PRINT;
-            _range_start = get_numerical_value(result.str(18));
-            _range_end = get_numerical_value(result.str(19));
-        } else if (result.str(20).size() > 0) {
-            // group 20
-            _type = PRINT;
-            _range_start = get_numerical_value(result.str(21));
-            _range_end = _range_start;
-        } else if (result.str(22).size() > 0) {
-            // group 22
-            _type = PRINT;
-            _range_start = get_numerical_value(result.str(23));
-            _range_end = _current_line;
-        } else if (result.str(24).size() > 0) {
-            // group 24
-            _type = get_type_from_character(result.str(26));
-            _range_start = get_numerical_value(result.str(25));
-            _range_end = _range_start;
-        } else {
+    // we let the grammar below handle it after.
+    {
+        Lexer single(lexer);
+        single.advance();
+        if (single.at_end() && parse_single_character(lexer.peek()))
+            return true;
+    }
+
+    // The grammar, A being a number, '.' or '$' and N a number:
+    //   ,A[rpcnj]           from the current line to A
+    //   [tm]A               the current line
+    //   N,?[0-9]*[ud]       move by N lines
+    //   A,A[rpcnj]          range
+    //   A[rpcnj]            single line
+    //   A,[rpcnj]           from A to the current line
+    //   A,A  N  A,          print
+    //   A,?[0-9]*[ai]       append or insert
+    // 't' (copy) and 'm' (move) go wherever 'r' does,
+    // followed by A, the line the range goes after.
+    // '|' is accepted in place of any command letter and
+    // gives an invalid command type.
+    // Alternatives are tried in that order, first match wins.
+    char command('\0');
+    Address destination;
+    if (lexer.accept(',')) {
+        Address end = read_address(lexer);
+        if (end.kind == Address::NONE || !lexer.accept_one_of("rpcnjtm|", command)
+            || !read_destination(lexer, command, destination) || !lexer.at_end() || end.overflow)
             return false;
+        _type = get_type_from_character(command);
+        _range_start_reference = CURRENT_LINE;
+        return assign(_range_end, _range_end_reference, end)
+            && (destination.kind == Address::NONE || assign(_destination, _destination_reference, destination));
+    }
+
+    if (lexer.accept_one_of("tm", command)) {
+        if (!read_destination(lexer, command, destination) || !lexer.at_end())
+            return false;
+        _type = get_type_from_character(command);
+        _range_start_reference = CURRENT_LINE;
+        _range_end_reference = CURRENT_LINE;
+        return assign(_destination, _destination_reference, destination);
+    }
+
+    Address start = read_address(lexer);
+    if (start.kind == Address::NONE)
+        return false;
+    const bool comma = lexer.accept(',');
+    Address end;
+    if (comma || start.kind == Address::MARKER) {
+        end = read_address(lexer);
+        // without a comma, only digits may follow a marker.
+        if (!comma && end.kind == Address::MARKER)
+            return false;
+    }
+    const bool has_command = lexer.accept_one_of("udrpcnjtmai|", command);
+    if (!read_destination(lexer, command, destination) || !lexer.at_end())
+        return false;
+    if (destination.kind != Address::NONE && !assign(_destination, _destination_reference, destination))
+        return false;
+
+    // only numbers may follow the comma in the move and append commands.
+    const bool digits_only = end.kind != Address::MARKER;
+    if (has_command) {
+        if (start.kind == Address::NUMBER && digits_only && strchr("ud|", command)) {
+            _type = get_type_from_character(command);
+            _line_number = start.value;
+            return !start.overflow;
+        } else if (comma && end.kind != Address::NONE && strchr("rpcnjtm|", command)) {
+            _type = get_type_from_character(command);
+            return assign(_range_start, _range_start_reference, start) && assign(_range_end, _range_end_reference, end);
+        } else if (!comma && end.kind == Address::NONE && strchr("rpcnjtm|", command)) {
+            _type = get_type_from_character(command);
+            return assign(_range_start, _range_start_reference, start) && assign(_range_end, _range_end_reference, start);
+        } else if (comma && end.kind == Address::NONE && strchr("rpcnjtm|", command)) {
+            _type = get_type_from_character(command);
+            _range_end_reference = CURRENT_LINE;
+            return assign(_range_start, _range_start_reference, start);
+        } else if (digits_only && strchr("ai|", command)) {
+            _type = get_type_from_character(command);
+            return assign(_range_start, _range_start_reference, start) && assign(_range_end, _range_end_reference, start);
         }
-        return true;
+        return false;
+    }
+
+    if (comma && end.kind != Address::NONE) {
+        _type = PRINT;
+        return assign(_range_start, _range_start_reference, start) && assign(_range_end, _range_end_reference, end);
+    } else if (!comma && end.kind == Address::NONE && start.kind == Address::NUMBER) {
+        _type = PRINT;
+        return assign(_range_start, _range_start_reference, start) && assign(_range_end, _range_end_reference, start);
+    } else if (comma) {
+        _type = PRINT;
+        _range_end_reference = CURRENT_LINE;
+        return assign(_range_start, _range_start_reference, start);
     }
     return false;
 }
 
-size_t Command::get_numerical_value(const string& val) {
-    if (val == ".")
-        return _current_line;
-    if (val == "$")
-        return _last_line;
-    return stoul(val);
+bool Command::parse_search(const string& input) {
+    // /text/ searches forward, ?text? backward; the closing
+    // delimiter may be left out. An empty text repeats the last search.
+    Lexer lexer(input);
+    const char delimiter = lexer.peek();
+    if (delimiter != '/' && delimiter != '?')
+        return false;
+    _type = (delimiter == '/') ? SEARCH_FORWARD : SEARCH_BACKWARD;
+    if (lexer.read_delimited(_pattern) && !lexer.at_end())
+        _type = INVALID;
+    return true;
 }
 
-CommandType Command::get_type_from_character(const string& character) {
-    if (character.size() > 1) {
-        return INVALID;
-    } else if (character.size() == 0) {
-        return PRINT_CURRENT_LINE;
+bool Command::parse_named(const string& input) {
+    Lexer lexer(input);
+    if (!lexer.accept(':'))
+        return false;
+    if (lexer.rest_is("stats")) {
+        _type = STATS;
+    } else if (lexer.rest_is("ls")) {
+        _type = LIST_FILES;
+    } else if (lexer.rest_is("bn")) {
+        _type = NEXT_FILE;
+    } else if (lexer.rest_is("bp")) {
+        _type = PREVIOUS_FILE;
+    } else if (lexer.accept('b')) {
+        // :b N, spaces allowed.
+        const Address file = read_address(lexer);
+        if (file.kind == Address::NUMBER && !file.overflow && file.value > 0 && lexer.at_end()) {
+            _type = SWITCH_FILE;
+            _line_number = file.value;
+        }
     }
-    switch (character[0]) {
+    return true;
+}
+
+bool Command::parse_global(const string& input) {
+    Lexer lexer(input);
+    // [A[,A]](g|v)/re/[pnrc], the delimiter being any character but a
+    // blank or '\\'. Without addresses the whole buffer is searched.
+    Address start = read_address(lexer);
+    const bool comma = start.kind != Address::NONE && lexer.accept(',');
+    Address end;
+    if (comma)
+        end = read_address(lexer);
+    char command;
+    if (!lexer.accept_one_of("gv", command))
+        return false;
+
+    // from here on it can only be a global command.
+    _type = INVALID;
+    _inverted = (command == 'v');
+    if (lexer.at_end() || lexer.peek() == '\\' || (comma && end.kind == Address::NONE))
+        return true;
+    if (!lexer.read_delimited(_pattern))
+        return true;
+    char action('p');
+    lexer.accept_one_of("pnrc", action);
+    if (!lexer.at_end())
+        return true;
+    if (start.kind == Address::NONE) {
+        _range_start = 1;
+        _range_end_reference = LAST_LINE;
+    } else if (!assign(_range_start, _range_start_reference, start)
+               || !assign(_range_end, _range_end_reference, comma ? end : start)) {
+        return true;
+    }
+    _global_type = get_type_from_character(action);
+    _type = GLOBAL;
+    return true;
+}
+
+CommandType Command::get_type_from_character(char character) {
+    switch (character) {
         case 'a':
             return APPEND;
         case 'i':
@@ -141,6 +410,18 @@ CommandType Command::get_type_from_character(const string& character) {
             return QUIT;
         case '=':
             return PRINT_CURRENT_LINE;
+        case 'U':
+            return UNDO;
+        case 'R':
+            return REDO;
+        case 't':
+            return COPY;
+        case 'm':
+            return MOVE;
+        case 'j':
+            return JOIN;
+        case 'e':
+            return RELOAD;
         default:
             return INVALID;
     }
@@ -155,17 +436,17 @@ bool Command::parse_single_character(char input) {
         case ',':
             _type = PRINT;
             _range_start = 1;
-            _range_end = _last_line;
+            _range_end_reference = LAST_LINE;
             return true;
         case '$':
             _type = PRINT;
-            _range_start = _last_line;
-            _range_end = _last_line;
+            _range_start_reference = LAST_LINE;
+            _range_end_reference = LAST_LINE;
             return true;
         case '.':
             _type = PRINT;
-            _range_start = _current_line;
-            _range_end = _current_line;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
             return true;
         case 'w':
             _type = WRITE;
@@ -173,32 +454,38 @@ bool Command::parse_single_character(char input) {
         case 'q':
             _type = QUIT;
             return true;
+        case 'U':
+            _type = UNDO;
+            return true;
+        case 'R':
+            _type = REDO;
+            return true;
         case 'i':
             _type = INSERT;
             //_line_number = _current_line;
-            _range_start = _current_line;
-            _range_end = _range_start;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
             return true;
         case 'a':
             _type = APPEND;
             //_line_number = _current_line;
-            _range_start = _current_line;
-            _range_end = _range_start;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
             return true;
         case 'p':
             _type = PRINT;
-            _range_start = _current_line;
-            _range_end = _current_line;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
             return true;
         case 'n':
             _type = PRINT_WITH_LINE_NUM;
-            _range_start = _current_line;
-            _range_end = _current_line;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
             return true;
         case 'c':
             _type = CHANGE;
-            _range_start = _current_line;
-            _range_end = _current_line;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
             return true;
         case 'u':
             _type = MOVE_UP;
@@ -210,8 +497,16 @@ bool Command::parse_single_character(char input) {
             return true;
         case 'r':
             _type = REMOVE;
-            _range_start = _current_line;
-            _range_end = _current_line;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
+            return true;
+        case 'j':
+            _type = JOIN;
+            _range_start_reference = CURRENT_LINE;
+            _range_end_reference = CURRENT_LINE;
+            return true;
+        case 'e':
+            _type = RELOAD;
             return true;
         default:
             return false;
@@ -244,23 +539,27 @@ size_t Command::getCurrentLine() const {
     return _current_line;
 }
 
+size_t Command::getDestination() const {
+    return _destination;
+}
+
+const string& Command::getPattern() const {
+    return _pattern;
+}
+
+CommandType Command::getGlobalType() const {
+    return _global_type;
+}
+
+bool Command::isInverted() const {
+    return _inverted;
+}
+
 bool Command::replace_all(string &input, const string &from, const string &to) {
-    bool changed = false;
-    if (input.empty() || from.empty()) {
-        return changed;
-    }
     string str;
-    str.reserve(input.length());
-    size_t start_pos(0);
-    size_t found_pos;
-    while ((found_pos = input.find(from, start_pos)) != string::npos) {
-        changed = true;
-        str += input.substr(start_pos, found_pos - start_pos);
-        str += to;
-        found_pos += from.length();
-        start_pos = found_pos;
+    if (!StringSearcher(from).replace_all(input.data(), input.size(), to, str)) {
+        return false;
     }
-    str += input.substr(start_pos, input.length()-start_pos);
     input.swap(str);
-    return changed;
+    return true;
 }
@@ -5,6 +5,7 @@
 
 using namespace std;
 
+
 enum CommandType {
     PRINT,
     QUIT,
@@ -17,6 +18,20 @@ enum CommandType {
     MOVE_UP,
     MOVE_DOWN,
     CHANGE,
+    UNDO,
+    REDO,
+    GLOBAL,
+    SEARCH_FORWARD,
+    SEARCH_BACKWARD,
+    STATS,
+    LIST_FILES,
+    SWITCH_FILE,
+    NEXT_FILE,
+    PREVIOUS_FILE,
+    COPY,
+    MOVE,
+    JOIN,
+    RELOAD,
     INVALID
 };
 
@@ -24,6 +39,16 @@ enum CommandType {
  * Class to translate a user command input into something the LineEditor class will understand.
  */
 class Command {
+public:
+    /**
+     * What a line value of the command refers to.
+     */
+    enum Reference {
+        ABSOLUTE,
+        CURRENT_LINE,
+        LAST_LINE
+    };
+
 private:
     
     /**
@@ -48,28 +73,68 @@ private:
      * Represents the end range.
      */
     size_t _range_end;
+
+    /**
+     * For copy and move: the line the range goes after (0 for the top).
+     */
+    size_t _destination;
+
+    /**
+     * Whether the range values are given or relative to the
+     * current or last line, so rebind can update them.
+     */
+    Reference _range_start_reference, _range_end_reference, _destination_reference;
     
     /**
      * Represents the command type.
      */
     CommandType _type;
-    
+
     /**
-     * Function to take care of the simple 1 character commands
+     * For the global commands: the pattern, the command run on the
+     * matching lines and whether it runs on the lines not matching instead.
+     * The searches only use the pattern, as plain text.
      */
-    bool parse_single_character(char input);
+    string _pattern;
+    CommandType _global_type;
+    bool _inverted;
     
     /**
-     * Given a string input, returns the command type.
+     * Does the actual parsing for parse, leaving the values
+     * relative to the current or last line unset.
+     */
+    bool parse_command(const string& input);
+
+    /**
+     * Parses a global command (g or v) if the input is one. Returns false
+     * if it isn't; otherwise returns true with the type left INVALID if
+     * the command is malformed.
+     */
+    bool parse_global(const string& input);
+
+    /**
+     * Parses /text/ or ?text? if the input starts with '/' or '?'.
+     * Returns false if it doesn't.
      */
-    CommandType get_type_from_character(const string&);
+    bool parse_search(const string& input);
+
+    /**
+     * Parses the commands made of a name after ':' (:stats, :ls, :bn,
+     * :bp and :b N) if the input starts with ':'. Returns false if it
+     * doesn't; otherwise returns true with the type left INVALID if the
+     * name is unknown.
+     */
+    bool parse_named(const string& input);
+
+    /**
+     * Function to take care of the simple 1 character commands
+     */
+    bool parse_single_character(char input);
     
     /**
-     * Gets the right numerical value given a string.
-     * Valid string are only ".", "$" or a string representing
-     * a positive integer. Unexpected results may occur otherwise.
+     * Given a command character, returns the command type.
      */
-    size_t get_numerical_value(const string& val);
+    CommandType get_type_from_character(char);
 
 public:
     // All default constructors and destructors.
@@ -84,6 +149,13 @@ public:
      * on failure. It does not validate (i.e does not check correct range.)
      */
     bool parse(const string& input);
+
+    /**
+     * Sets a new current and last line, updating the range values
+     * that were given as '.' or '$' or implied by the command.
+     * This lets a command be parsed once and executed many times.
+     */
+    void rebind(const size_t current_line, const size_t last_line);
     
     //Below are the getters for use after parsing is done.
     CommandType getType() const;
@@ -92,11 +164,32 @@ public:
     
     size_t getRangeEnd() const;
     
+    /**
+     * The line number, or the file number for SWITCH_FILE.
+     */
     size_t getLineNumber() const;
     
     size_t getNumberOfLines() const;
     
     size_t getCurrentLine() const;
+
+    /**
+     * For COPY and MOVE: the line after which the range goes, 0 for
+     * the top of the file.
+     */
+    size_t getDestination() const;
+
+    /**
+     * For GLOBAL: the pattern (empty to reuse the last one), the command
+     * to run on the lines (PRINT, PRINT_WITH_LINE_NUM, REMOVE or CHANGE)
+     * and whether it applies to the lines that don't match.
+     * For the searches, the pattern is the text searched.
+     */
+    const string& getPattern() const;
+
+    CommandType getGlobalType() const;
+
+    bool isInverted() const;
     
     /**
      * Utility function that replaces all occurrences
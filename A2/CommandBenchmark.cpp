@@ -0,0 +1,432 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "LineEditor.h"
+#include "Stats.h"
+
+using namespace std;
+
+/**
+ * Times the editor's commands on generated files of short, long and mixed
+ * lines, driving LineEditor::executeCommand with the output thrown away.
+ * Each case runs in its own process, so its peak memory is its own.
+ * Prints one tab separated line per case, to be compared across builds:
+ * the time per command, the lines handled per second, the number of
+ * allocations (none when built with -DNO_STATS) and the peak resident memory.
+ * Usage: ./command_bench [-l] [-d directory] [number_of_lines...]
+ */
+
+namespace {
+
+/**
+ * Small files are run several times: each case handles about that many lines.
+ */
+const size_t LINES_PER_CASE = 1000000;
+
+/**
+ * Number of single line removes timed.
+ */
+const size_t REMOVES = 1000;
+
+/**
+ * Number of commands timed around one line of the file.
+ */
+const size_t BROWSE_COMMANDS = 10000;
+
+/**
+ * The text the searches look for, only found on the last line.
+ */
+const string NEEDLE("needle");
+
+enum LineKind {
+    SHORT_LINES,
+    LONG_LINES,
+    MIXED_LINES
+};
+
+const char* const KIND_NAMES[] = { "short", "long", "mixed" };
+
+/**
+ * Discards everything written to it.
+ */
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int character) override {
+        return traits_type::not_eof(character);
+    }
+
+    streamsize xsputn(const char*, streamsize count) override {
+        return count;
+    }
+};
+
+size_t line_length(const LineKind kind, minstd_rand& random) {
+    switch (kind) {
+        case SHORT_LINES:
+            return 4 + random() % 13;
+        case LONG_LINES:
+            return 64 + random() % 257;
+        case MIXED_LINES:
+        default:
+            // mostly short lines, with a long one now and then.
+            return random() % 8 ? 4 + random() % 13 : 512 + random() % 3585;
+    }
+}
+
+/**
+ * Writes the file unless it is already there: the same arguments
+ * always give the same file.
+ */
+bool generate(const string& filename, const LineKind kind, const size_t lines) {
+    if (ifstream(filename)) {
+        return true;
+    }
+    ofstream file(filename, ios::binary);
+    minstd_rand random(1);
+    string chunk;
+    for (size_t i = 0; i + 1 < lines; ++i) {
+        const size_t length = line_length(kind, random);
+        for (size_t j = 0; j < length; ++j) {
+            // words of about 6 letters.
+            chunk += random() % 7 ? static_cast<char>('a' + random() % 26) : ' ';
+        }
+        chunk += '\n';
+        if (chunk.size() >= 1 << 20) {
+            file << chunk;
+            chunk.clear();
+        }
+    }
+    if (lines > 0) {
+        chunk += "the " + NEEDLE + "\n";
+    }
+    file << chunk;
+    file.close();
+    if (!file) {
+        remove(filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+string read_file(const string& filename) {
+    ifstream file(filename, ios::binary);
+    return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+struct Result {
+    size_t ops;
+    size_t lines;
+    double nanoseconds;
+    size_t allocations;
+};
+
+/**
+ * An editor on one file, with its output thrown away. The editor is
+ * only opened when first needed, so opening it can be timed too.
+ */
+class Session {
+private:
+    const string _filename;
+    const BufferType _type;
+    NullBuffer _null_buffer;
+    ostream _null;
+    unique_ptr<LineEditor> _editor;
+    istringstream _input;
+
+public:
+    /**
+     * The number of lines in the buffer, kept up to date by the cases,
+     * for '$' in the commands.
+     */
+    size_t size;
+
+    Result result;
+
+    Session(const string& filename, const BufferType type, const size_t lines) :
+    _filename(filename), _type(type), _null(&_null_buffer), size(lines), result({ 0, 0, 0, 0 }) { }
+
+    const string& filename() const {
+        return _filename;
+    }
+
+    LineEditor& editor() {
+        if (!_editor) {
+            _editor.reset(new LineEditor(_filename, _type, _null, cerr));
+            _editor->setInput(_input);
+        }
+        return *_editor;
+    }
+
+    /**
+     * Sets what the next commands read.
+     */
+    void input(const string& text) {
+        _input.clear();
+        _input.str(text);
+        if (_editor) { // it read ahead in the previous input.
+            _editor->setInput(_input);
+        }
+    }
+
+    /**
+     * Reads the input again from its start.
+     */
+    void rewind() {
+        _input.clear();
+        _input.seekg(0);
+        if (_editor) {
+            _editor->setInput(_input);
+        }
+    }
+
+    void execute(const string& text) {
+        Command command(1, size == 0 ? 1 : size);
+        if (!command.parse(text)) {
+            cerr << "Invalid command " << text << endl;
+            exit(EXIT_FAILURE);
+        }
+        editor().executeCommand(command);
+    }
+
+    /**
+     * Times ops calls of function (given the call's number),
+     * each handling lines_per_op lines.
+     */
+    template <typename Function>
+    void time(const size_t ops, const size_t lines_per_op, Function function) {
+        const size_t allocated = Stats::allocations();
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < ops; ++i) {
+            function(i);
+        }
+        result.nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        result.allocations = Stats::allocations() - allocated;
+        result.ops = ops;
+        result.lines = ops * lines_per_op;
+    }
+
+    /**
+     * Quits without writing, which also removes the journal.
+     */
+    void quit() {
+        input("n\n");
+        execute("q");
+    }
+};
+
+/**
+ * Times commands on and around the given line, as when reading that
+ * part of the file: the time per command should be about the same
+ * wherever the line is.
+ */
+void browse(Session& session, const size_t line) {
+    const string here = to_string(line);
+    const string commands[] = { here + "p", "d", "u", here + "," + to_string(min(session.size, line + 5)) + "n", "3d", "3u" };
+    const size_t count = sizeof(commands) / sizeof(commands[0]);
+    // getting there once is not timed.
+    session.execute(commands[0]);
+    session.time(BROWSE_COMMANDS, 1, [&](size_t i) {
+        session.execute(commands[i % count]);
+    });
+}
+
+struct Case {
+    const char* name;
+
+    /**
+     * Whether the case opens the file itself, so opening is timed.
+     */
+    bool opens;
+
+    void (*run)(Session& session, const size_t repeat);
+};
+
+const Case CASES[] = {
+    { "open", true, [](Session& session, const size_t) {
+        session.time(1, session.size, [&](size_t) {
+            session.editor();
+        });
+    } },
+    { "append", false, [](Session& session, const size_t repeat) {
+        // the file itself is the text appended.
+        session.input(read_file(session.filename()) + ".\n");
+        const size_t lines = session.size;
+        session.time(repeat, lines, [&](size_t) {
+            session.rewind();
+            session.execute("$a");
+            session.size += lines;
+        });
+    } },
+    { "print", false, [](Session& session, const size_t repeat) {
+        session.time(repeat, session.size, [&](size_t) {
+            session.execute("1,$p");
+        });
+    } },
+    { "number", false, [](Session& session, const size_t repeat) {
+        session.time(repeat, session.size, [&](size_t) {
+            session.execute("1,$n");
+        });
+    } },
+    { "change", false, [](Session& session, const size_t repeat) {
+        const string swaps[] = { "e\nE\n", "E\ne\n" };
+        session.time(repeat, session.size, [&](size_t i) {
+            session.input(swaps[i % 2]);
+            session.execute("1,$c");
+        });
+    } },
+    { "undo", false, [](Session& session, const size_t repeat) {
+        session.input("e\nE\n");
+        session.execute("1,$c");
+        session.time(2 * repeat, session.size, [&](size_t i) {
+            session.execute(i % 2 ? "R" : "U");
+        });
+    } },
+    { "remove", false, [](Session& session, const size_t) {
+        const size_t removes = min(REMOVES, session.size / 2);
+        session.time(removes, 1, [&](size_t i) {
+            // spread over the buffer.
+            session.execute(to_string(1 + i * 7919 % session.size) + "r");
+            --session.size;
+        });
+    } },
+    { "browse_top", false, [](Session& session, const size_t) {
+        browse(session, min<size_t>(10, session.size));
+    } },
+    { "browse_middle", false, [](Session& session, const size_t) {
+        browse(session, max<size_t>(1, session.size / 2));
+    } },
+    { "browse_end", false, [](Session& session, const size_t) {
+        browse(session, session.size > 10 ? session.size - 10 : session.size);
+    } },
+    { "search", false, [](Session& session, const size_t repeat) {
+        session.time(repeat, session.size, [&](size_t) {
+            session.execute("/" + NEEDLE + "/");
+        });
+    } },
+    { "global", false, [](Session& session, const size_t repeat) {
+        session.time(repeat, session.size, [&](size_t) {
+            session.execute("g/" + NEEDLE + "/p");
+        });
+    } },
+    { "write", false, [](Session& session, const size_t repeat) {
+        session.time(repeat, session.size, [&](size_t) {
+            session.execute("w");
+        });
+    } }
+};
+
+size_t peak_memory_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+void report(const char* name, const char* engine, const char* kind, const size_t lines, const Result& result) {
+    const double per_op = result.ops ? result.nanoseconds / result.ops : 0;
+    const double lines_per_second = result.nanoseconds > 0 ? result.lines * 1e9 / result.nanoseconds : 0;
+    cout << name << "\t" << engine << "\t" << kind << "\t" << lines << "\t" << result.ops << "\t"
+         << static_cast<size_t>(per_op) << "\t" << static_cast<size_t>(lines_per_second) << "\t"
+         << result.allocations << "\t" << peak_memory_kb() << endl;
+}
+
+/**
+ * Parses a few typical commands over and over.
+ */
+void parse_commands(const char* engine) {
+    const string commands[] = { "p", "1,$p", "12,345n", ".,$r", "3", "$", "10u", "c", "g/a.*b/p", "/text/" };
+    const size_t parses = 1000000;
+    Session session("", PIECE_TABLE_BUFFER, 1000);
+    session.time(parses, 0, [&](size_t i) {
+        Command command(1, 1000);
+        command.parse(commands[i % (sizeof(commands) / sizeof(commands[0]))]);
+    });
+    report("parse", engine, "-", 0, session.result);
+}
+
+/**
+ * Runs the case in a child process.
+ */
+bool run_case(const Case& bench_case, const string& filename, const BufferType type, const char* engine,
+              const char* kind, const size_t lines) {
+    const pid_t child = fork();
+    if (child < 0) {
+        return false;
+    }
+    if (child == 0) {
+        // left over by a case that didn't finish.
+        remove((filename + ".journal").c_str());
+        Session session(filename, type, lines);
+        if (!bench_case.opens) {
+            session.editor();
+        }
+        bench_case.run(session, max<size_t>(1, LINES_PER_CASE / max<size_t>(1, lines)));
+        report(bench_case.name, engine, kind, lines, session.result);
+        session.quit();
+        _exit(EXIT_SUCCESS);
+    }
+    int status(0);
+    return waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, const char * argv[]) {
+    BufferType type(PIECE_TABLE_BUFFER);
+    const char* temporary = getenv("TMPDIR");
+    string directory(temporary ? temporary : "/tmp");
+    vector<size_t> line_counts;
+    for (int i = 1; i < argc; ++i) {
+        const string argument(argv[i]);
+        char* end(nullptr);
+        if (argument == "-l") {
+            type = LIST_BUFFER;
+        } else if (argument == "-d") {
+            if (++i == argc) {
+                cerr << "No directory given." << endl;
+                return EXIT_FAILURE;
+            }
+            directory = argv[i];
+        } else if (line_counts.push_back(strtoul(argv[i], &end, 10)), *end != '\0' || line_counts.back() == 0) {
+            cerr << "Usage: " << argv[0] << " [-l] [-d directory] [number_of_lines...]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (line_counts.empty()) {
+        line_counts = { 1000, 100000, 1000000 };
+    }
+    const char* engine = type == LIST_BUFFER ? "list" : "piece_table";
+
+    cout << "case\tengine\tkind\tlines\tops\tns_per_op\tlines_per_sec\tallocations\tpeak_rss_kb" << endl;
+    parse_commands(engine);
+    int status(EXIT_SUCCESS);
+    for (size_t lines : line_counts) {
+        for (LineKind kind : { SHORT_LINES, LONG_LINES, MIXED_LINES }) {
+            const string filename = directory + "/led_bench_" + KIND_NAMES[kind] + "_" + to_string(lines) + ".txt";
+            if (!generate(filename, kind, lines)) {
+                cerr << "Unable to write " << filename << endl;
+                return EXIT_FAILURE;
+            }
+            for (const Case& bench_case : CASES) {
+                if (!run_case(bench_case, filename, type, engine, KIND_NAMES[kind], lines)) {
+                    cerr << bench_case.name << " failed on " << filename << endl;
+                    status = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    return status;
+}
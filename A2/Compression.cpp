@@ -0,0 +1,483 @@
+#include "Compression.h"
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#include "Parallel.h"
+
+const int Compression::DEFAULT_LEVEL;
+
+namespace {
+
+/**
+ * Bytes compressed in each BGZF member, as bgzip does: the member
+ * then always fits in the 64KB its header can describe.
+ */
+const size_t GZIP_BLOCK = 0xff00;
+
+/**
+ * The most any BGZF member may hold uncompressed.
+ */
+const size_t GZIP_BLOCK_LIMIT = 1 << 16;
+
+const size_t ZSTD_BLOCK = 4 << 20;
+
+/**
+ * Blocks are only spread over several threads
+ * when each one gets at least that many bytes.
+ */
+const size_t MIN_BYTES_PER_THREAD = 4 << 20;
+
+/**
+ * zlib counts its input and output in unsigned ints.
+ */
+const size_t MAX_ZLIB_BYTES = 1 << 30;
+
+/**
+ * Header of a BGZF member: gzip with an extra field ('BC')
+ * whose last 2 bytes, the member size minus 1, are set later.
+ */
+const char BGZF_HEADER[16] = { '\x1f', '\x8b', 8, 4, 0, 0, 0, 0, 0, '\xff', 6, 0, 'B', 'C', 2, 0 };
+const size_t BGZF_HEADER_SIZE = 18;
+const size_t GZIP_TRAILER_SIZE = 8;
+
+/**
+ * The smallest gzip member: a header without optional fields and the trailer.
+ */
+const size_t MIN_GZIP_MEMBER_SIZE = 10 + GZIP_TRAILER_SIZE;
+
+/**
+ * A size read from a trailer is only trusted up to that ratio for the
+ * first allocation: it is not checked until the data is inflated.
+ */
+const size_t MAX_TRUSTED_RATIO = 8;
+
+/**
+ * The same for the sizes zstd frames announce, which decide the whole
+ * allocation. zstd compresses text far more than gzip: the frames 'w'
+ * writes hold about 50 times their size of ordinary text.
+ */
+const size_t MAX_TRUSTED_ZSTD_RATIO = 128;
+
+/**
+ * An empty member marking the end of a BGZF file.
+ */
+const char BGZF_END[28] = { '\x1f', '\x8b', 8, 4, 0, 0, 0, 0, 0, '\xff', 6, 0, 'B', 'C', 2, 0,
+                            0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+/**
+ * A block of a compressed file that can be decompressed on its own.
+ */
+struct Frame {
+    size_t offset, size;
+    size_t output_offset, output_size;
+};
+
+size_t read_little_endian(const char* data, const size_t bytes) {
+    size_t value(0);
+    for (size_t i = bytes; i-- > 0;) {
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+    }
+    return value;
+}
+
+void write_little_endian(char* data, size_t value, const size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i, value >>= 8) {
+        data[i] = static_cast<char>(value & 0xff);
+    }
+}
+
+bool ends_with(const string& text, const string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/**
+ * Doubles the capacity of a buffer holding used bytes.
+ */
+void grow(unique_ptr<char[]>& buffer, size_t& capacity, const size_t used) {
+    capacity = max<size_t>(capacity * 2, 1 << 16);
+    unique_ptr<char[]> larger(new char[capacity]);
+    memcpy(larger.get(), buffer.get(), used);
+    buffer.swap(larger);
+}
+
+/**
+ * Hands over the used bytes of the buffer, copied to a
+ * buffer of their size if a quarter of it would be wasted.
+ */
+void release(unique_ptr<char[]>& buffer, const size_t capacity, const size_t used,
+             char*& output, size_t& output_size) {
+    if (used == 0) {
+        output = nullptr;
+    } else if (capacity - used > capacity / 4) {
+        output = new char[used];
+        memcpy(output, buffer.get(), used);
+    } else {
+        output = buffer.release();
+    }
+    output_size = used;
+}
+
+/**
+ * Finds the members of a BGZF file from the sizes in their headers.
+ * Returns false if any of them doesn't give its size.
+ */
+bool bgzf_members(const char* data, const size_t size, vector<Frame>& members) {
+    size_t output_offset(0);
+    for (size_t position = 0; position < size;) {
+        const char* member = data + position;
+        const size_t available = size - position;
+        if (available < BGZF_HEADER_SIZE + GZIP_TRAILER_SIZE || memcmp(member, BGZF_HEADER, 4) != 0) {
+            return false;
+        }
+        const size_t extra_end = 12 + read_little_endian(member + 10, 2);
+        size_t member_size(0);
+        for (size_t field = 12; field + 4 <= extra_end && extra_end <= available;
+             field += 4 + read_little_endian(member + field + 2, 2)) {
+            if (member[field] == 'B' && member[field + 1] == 'C' && read_little_endian(member + field + 2, 2) == 2
+                && field + 6 <= extra_end) {
+                member_size = read_little_endian(member + field + 4, 2) + 1;
+            }
+        }
+        if (member_size < extra_end + GZIP_TRAILER_SIZE || member_size > available) {
+            return false;
+        }
+        const size_t output_size = read_little_endian(member + member_size - 4, 4);
+        if (output_size > GZIP_BLOCK_LIMIT) {
+            // not BGZF after all: its members never hold more.
+            return false;
+        }
+        members.push_back({ position, member_size, output_offset, output_size });
+        output_offset += output_size;
+        position += member_size;
+    }
+    return true;
+}
+
+bool inflate_members(const char* data, const vector<Frame>& members, char* output) {
+    atomic<bool> failed(false);
+    parallel_chunks(members.size(), MIN_BYTES_PER_THREAD / GZIP_BLOCK, [&](size_t, size_t first, size_t last) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+            failed = true;
+            return;
+        }
+        for (size_t i = first; i < last && !failed; ++i) {
+            const Frame& member = members[i];
+            if (member.output_size == 0) {
+                continue;
+            }
+            inflateReset(&stream);
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + member.offset));
+            stream.avail_in = member.size;
+            stream.next_out = reinterpret_cast<Bytef*>(output + member.output_offset);
+            stream.avail_out = member.output_size;
+            if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.avail_out != 0) {
+                failed = true;
+            }
+        }
+        inflateEnd(&stream);
+    });
+    return !failed;
+}
+
+/**
+ * Decompresses any gzip file, one member after the other.
+ */
+bool inflate_all(const char* data, const size_t size, char*& output, size_t& output_size) {
+    if (size < MIN_GZIP_MEMBER_SIZE) {
+        return false;
+    }
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+        return false;
+    }
+    // the size of the last member (modulo 4GB) is usually the size of it all.
+    const size_t trailer_size = read_little_endian(data + size - 4, 4);
+    size_t capacity = max(min(trailer_size, size * MAX_TRUSTED_RATIO), size);
+    unique_ptr<char[]> buffer(new char[capacity]);
+    size_t used(0), given(0);
+    bool valid(true);
+    while (true) {
+        if (stream.avail_in == 0 && given < size) {
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + given));
+            stream.avail_in = min(size - given, MAX_ZLIB_BYTES);
+            given += stream.avail_in;
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(buffer.get() + used);
+        stream.avail_out = min(capacity - used, MAX_ZLIB_BYTES);
+        const size_t available = stream.avail_out;
+        const int result = inflate(&stream, Z_NO_FLUSH);
+        used += available - stream.avail_out;
+        if (result == Z_STREAM_END) {
+            if (stream.avail_in == 0 && given < size) {
+                stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + given));
+                stream.avail_in = min(size - given, MAX_ZLIB_BYTES);
+                given += stream.avail_in;
+            }
+            // another member may follow (concatenated files); anything else is ignored, as gzip does.
+            if (stream.avail_in == 0 || *stream.next_in != 0x1f) {
+                break;
+            }
+            inflateReset(&stream);
+        } else if (result == Z_BUF_ERROR && stream.avail_out == 0) {
+            grow(buffer, capacity, used);
+        } else if (result != Z_OK) {
+            valid = false; // corrupted or truncated.
+            break;
+        }
+    }
+    inflateEnd(&stream);
+    if (valid) {
+        release(buffer, capacity, used, output, output_size);
+    }
+    return valid;
+}
+
+/**
+ * Compresses blocks [first, last) of the data as BGZF members.
+ */
+bool deflate_blocks(const int level, const char* data, const size_t size,
+                    const size_t first, const size_t last, vector<string>& blocks) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, max(0, min(level, 9)), Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    bool valid(true);
+    for (size_t i = first; i < last && valid; ++i) {
+        const char* input = data + i * GZIP_BLOCK;
+        const size_t length = min(GZIP_BLOCK, size - i * GZIP_BLOCK);
+        string& block = blocks[i];
+        deflateReset(&stream);
+        block.resize(BGZF_HEADER_SIZE + deflateBound(&stream, length) + GZIP_TRAILER_SIZE);
+        char* member = &block[0];
+        memcpy(member, BGZF_HEADER, sizeof(BGZF_HEADER));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input));
+        stream.avail_in = length;
+        stream.next_out = reinterpret_cast<Bytef*>(member + BGZF_HEADER_SIZE);
+        stream.avail_out = block.size() - BGZF_HEADER_SIZE - GZIP_TRAILER_SIZE;
+        valid = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+        const size_t member_size = BGZF_HEADER_SIZE + stream.total_out + GZIP_TRAILER_SIZE;
+        write_little_endian(member + 16, member_size - 1, 2);
+        write_little_endian(member + BGZF_HEADER_SIZE + stream.total_out,
+                            crc32(0, reinterpret_cast<const Bytef*>(input), length), 4);
+        write_little_endian(member + BGZF_HEADER_SIZE + stream.total_out + 4, length, 4);
+        block.resize(member_size);
+    }
+    deflateEnd(&stream);
+    return valid;
+}
+
+#ifdef WITH_ZSTD
+
+/**
+ * Finds the frames of a zstd file. Returns false if any of them doesn't
+ * give the size of its content, or if these sizes add up to more than
+ * MAX_TRUSTED_ZSTD_RATIO times the file: the sizes are only checked once
+ * decompressed, the stream then grows as the data really does.
+ */
+bool zstd_frames(const char* data, const size_t size, vector<Frame>& frames) {
+    const size_t trusted = size * MAX_TRUSTED_ZSTD_RATIO;
+    size_t output_offset(0);
+    for (size_t position = 0; position < size;) {
+        const size_t frame_size = ZSTD_findFrameCompressedSize(data + position, size - position);
+        if (ZSTD_isError(frame_size)) {
+            return false;
+        }
+        const unsigned long long output_size = ZSTD_getFrameContentSize(data + position, frame_size);
+        if (output_size == ZSTD_CONTENTSIZE_UNKNOWN || output_size == ZSTD_CONTENTSIZE_ERROR
+            || output_size > trusted - output_offset) {
+            return false;
+        }
+        frames.push_back({ position, frame_size, output_offset, static_cast<size_t>(output_size) });
+        output_offset += output_size;
+        position += frame_size;
+    }
+    return true;
+}
+
+bool zstd_decompress_frames(const char* data, const vector<Frame>& frames, char* output) {
+    atomic<bool> failed(false);
+    parallel_chunks(frames.size(), 1, [&](size_t, size_t first, size_t last) {
+        ZSTD_DCtx* context = ZSTD_createDCtx();
+        for (size_t i = first; i < last && !failed; ++i) {
+            const Frame& frame = frames[i];
+            const size_t result = ZSTD_decompressDCtx(context, output + frame.output_offset, frame.output_size,
+                                                      data + frame.offset, frame.size);
+            if (ZSTD_isError(result) || result != frame.output_size) {
+                failed = true;
+            }
+        }
+        ZSTD_freeDCtx(context);
+    });
+    return !failed;
+}
+
+/**
+ * Decompresses any zstd file as a stream.
+ */
+bool zstd_decompress_all(const char* data, const size_t size, char*& output, size_t& output_size) {
+    ZSTD_DCtx* context = ZSTD_createDCtx();
+    size_t capacity = size * 4;
+    unique_ptr<char[]> buffer(new char[capacity]);
+    size_t used(0);
+    ZSTD_inBuffer input = { data, size, 0 };
+    size_t pending(1);
+    bool valid(true);
+    while (input.pos < input.size || pending != 0) {
+        if (used == capacity) {
+            grow(buffer, capacity, used);
+        }
+        ZSTD_outBuffer out = { buffer.get() + used, capacity - used, 0 };
+        pending = ZSTD_decompressStream(context, &out, &input);
+        used += out.pos;
+        // an error, or a frame cut short: no more input while there is still room for its output.
+        if (ZSTD_isError(pending) || (input.pos == input.size && pending != 0 && out.pos < out.size)) {
+            valid = false;
+            break;
+        }
+    }
+    ZSTD_freeDCtx(context);
+    if (valid) {
+        release(buffer, capacity, used, output, output_size);
+    }
+    return valid;
+}
+
+bool zstd_compress_blocks(const int level, const char* data, const size_t size,
+                          const size_t first, const size_t last, vector<string>& blocks) {
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+    bool valid(true);
+    for (size_t i = first; i < last && valid; ++i) {
+        const char* input = data + i * ZSTD_BLOCK;
+        const size_t length = min(ZSTD_BLOCK, size - i * ZSTD_BLOCK);
+        string& block = blocks[i];
+        block.resize(ZSTD_compressBound(length));
+        const size_t result = ZSTD_compressCCtx(context, &block[0], block.size(), input, length, level);
+        valid = !ZSTD_isError(result);
+        block.resize(valid ? result : 0);
+    }
+    ZSTD_freeCCtx(context);
+    return valid;
+}
+
+#endif
+
+}
+
+Compression::Format Compression::format(const string& filename) {
+    if (ends_with(filename, ".gz")) {
+        return GZIP;
+    }
+    if (ends_with(filename, ".zst")) {
+        return ZSTD;
+    }
+    return NONE;
+}
+
+bool Compression::supported(const Format format) {
+#ifdef WITH_ZSTD
+    return true;
+#else
+    return format != ZSTD;
+#endif
+}
+
+bool Compression::decompress(const Format format, const char* data, const size_t size,
+                             char*& output, size_t& output_size) {
+    output = nullptr;
+    output_size = 0;
+    if (size == 0) {
+        return true;
+    }
+    vector<Frame> frames;
+    switch (format) {
+        case NONE:
+            output = new char[size];
+            memcpy(output, data, size);
+            output_size = size;
+            return true;
+        case GZIP:
+            if (!bgzf_members(data, size, frames)) {
+                return inflate_all(data, size, output, output_size);
+            }
+            break;
+        case ZSTD:
+#ifdef WITH_ZSTD
+            if (!zstd_frames(data, size, frames)) {
+                return zstd_decompress_all(data, size, output, output_size);
+            }
+#endif
+            break;
+    }
+    if (!supported(format)) {
+        return false;
+    }
+    // every block knows where its output goes: they are all decompressed at once.
+    const size_t total = frames.back().output_offset + frames.back().output_size;
+    unique_ptr<char[]> buffer(total ? new char[total] : nullptr);
+    bool valid(false);
+    if (format == GZIP) {
+        valid = inflate_members(data, frames, buffer.get());
+    }
+#ifdef WITH_ZSTD
+    if (format == ZSTD) {
+        valid = zstd_decompress_frames(data, frames, buffer.get());
+    }
+#endif
+    if (valid) {
+        output = buffer.release();
+        output_size = total;
+    }
+    return valid;
+}
+
+bool Compression::compress(const Format format, const int level, const char* data, const size_t size,
+                           string& output) {
+    if (format == NONE) {
+        output.append(data, size);
+        return true;
+    }
+    if (!supported(format)) {
+        return false;
+    }
+    const size_t block_size = (format == GZIP) ? GZIP_BLOCK : ZSTD_BLOCK;
+    // at least one block: an empty file still gets a valid header.
+    vector<string> blocks(max<size_t>(1, (size + block_size - 1) / block_size));
+    atomic<bool> failed(false);
+    parallel_chunks(blocks.size(), max<size_t>(1, MIN_BYTES_PER_THREAD / block_size),
+                    [&](size_t, size_t first, size_t last) {
+        bool valid(false);
+        if (format == GZIP) {
+            valid = deflate_blocks(level, data, size, first, last, blocks);
+        }
+#ifdef WITH_ZSTD
+        if (format == ZSTD) {
+            valid = zstd_compress_blocks(level, data, size, first, last, blocks);
+        }
+#endif
+        if (!valid) {
+            failed = true;
+        }
+    });
+    size_t total(output.size());
+    for (auto it = begin(blocks); it != end(blocks); ++it) {
+        total += it->size();
+    }
+    output.reserve(total);
+    for (auto it = begin(blocks); it != end(blocks); ++it) {
+        output += *it;
+    }
+    return !failed;
+}
+
+string Compression::trailer(const Format format) {
+    return (format == GZIP) ? string(BGZF_END, sizeof(BGZF_END)) : string();
+}
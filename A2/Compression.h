@@ -0,0 +1,66 @@
+#ifndef Compression_h
+#define Compression_h
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+/**
+ * Reads and writes gzip (.gz) and zstd (.zst) files, using all cores.
+ *
+ * Files are written as independent blocks compressed in parallel:
+ * gzip as BGZF (members of at most 64KB, each giving its own size, which
+ * any gzip reader accepts) and zstd as one frame per 4MB. Reading
+ * decompresses such blocks in parallel, and any other file of the
+ * format in a single pass.
+ *
+ * zstd needs the library at build time: make ZSTD=1.
+ */
+class Compression {
+public:
+    enum Format {
+        NONE,
+        GZIP,
+        ZSTD
+    };
+
+    static const int DEFAULT_LEVEL = 6;
+
+    Compression()=delete;
+
+    /**
+     * The format of a file, from its extension.
+     */
+    static Format format(const string& filename);
+
+    /**
+     * Whether this build can read and write the format.
+     */
+    static bool supported(const Format format);
+
+    /**
+     * Decompresses the whole content of a file. The result is allocated
+     * with new[] (nullptr when empty) and belongs to the caller.
+     * Returns false if the content is not valid for the format or
+     * the format is not supported by this build.
+     */
+    static bool decompress(const Format format, const char* data, const size_t size,
+                           char*& output, size_t& output_size);
+
+    /**
+     * Compresses the data at the given level, appending the result to
+     * output. Compressed parts can be appended one after the other, the
+     * file then ends with trailer().
+     * Returns false if the format is not supported by this build.
+     */
+    static bool compress(const Format format, const int level, const char* data, const size_t size,
+                         string& output);
+
+    /**
+     * The bytes closing a file of the given format (possibly none).
+     */
+    static string trailer(const Format format);
+};
+
+#endif /* Compression_h */
@@ -0,0 +1,208 @@
+#include "FileWatcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define FILE_WATCHER_INOTIFY
+#endif
+
+const size_t FileWatcher::TAIL_BYTES;
+
+FileWatcher::FileWatcher() : _descriptor(-1), _watch(-1), _touched(false),
+    _status(), _reported(UNCHANGED) { }
+
+FileWatcher::~FileWatcher() {
+    close();
+}
+
+void FileWatcher::close() {
+    // the watch goes with the inotify instance.
+    if (_descriptor >= 0) {
+        ::close(_descriptor);
+        _descriptor = -1;
+        _watch = -1;
+    }
+}
+
+void FileWatcher::watch(const string& filename) {
+    _filename = filename;
+    _reported = UNCHANGED;
+#ifdef FILE_WATCHER_INOTIFY
+    if (_descriptor < 0) {
+        _descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    if (_descriptor >= 0) {
+        if (_watch >= 0) {
+            inotify_rm_watch(_descriptor, _watch);
+        }
+        // before reading the file, so that a change made meanwhile is not missed.
+        _watch = inotify_add_watch(_descriptor, filename.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+        read_events();
+    }
+#endif
+    _touched = false;
+    _status = Status();
+    _tail.clear();
+    const int descriptor = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        return;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) == 0) {
+        _status = status_of(info);
+        const size_t tail = min<size_t>(_status.size, TAIL_BYTES);
+        if (!read_at(descriptor, _status.size - tail, tail, _tail)) {
+            forget();
+        }
+    }
+    ::close(descriptor);
+}
+
+void FileWatcher::forget() {
+    _status = Status();
+    _tail.clear();
+    _touched = true;
+}
+
+FileWatcher::Change FileWatcher::check() {
+    read_events();
+    if (_watch >= 0 && !_touched) {
+        return UNCHANGED;
+    }
+    const Status now = status_of(_filename);
+    if (!now.exists) {
+        return _status.exists ? REMOVED : UNCHANGED;
+    }
+    if (same(now, _status)) {
+        return UNCHANGED;
+    }
+    if (!_status.exists || now.device != _status.device || now.inode != _status.inode || now.size <= _status.size) {
+        return REPLACED;
+    }
+    // the same file, longer: only appended to if it still ends as it did.
+    const int descriptor = ::open(_filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        return REPLACED;
+    }
+    string tail;
+    const bool appended = read_at(descriptor, _status.size - _tail.size(), _tail.size(), tail) && tail == _tail;
+    ::close(descriptor);
+    return appended ? GROWN : REPLACED;
+}
+
+bool FileWatcher::report(const Change change) {
+    if (change == _reported) {
+        return false;
+    }
+    _reported = change;
+    return true;
+}
+
+bool FileWatcher::ends_with_newline() const {
+    return _tail.empty() || _tail.back() == '\n';
+}
+
+bool FileWatcher::read_appended(string& bytes) {
+    bytes.clear();
+    // events from now on are about bytes not read here.
+    read_events();
+    _touched = false;
+    const int descriptor = ::open(_filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        _touched = true;
+        return false;
+    }
+    struct stat info;
+    bool read(false);
+    Status now = Status();
+    if (fstat(descriptor, &info) == 0) {
+        now = status_of(info);
+        read = now.device == _status.device && now.inode == _status.inode && now.size >= _status.size
+            && read_at(descriptor, _status.size, now.size - _status.size, bytes);
+    }
+    ::close(descriptor);
+    if (!read) {
+        _touched = true;
+        return false;
+    }
+    _status = now;
+    if (bytes.size() >= TAIL_BYTES) {
+        _tail.assign(bytes, bytes.size() - TAIL_BYTES, TAIL_BYTES);
+    } else {
+        _tail += bytes;
+        if (_tail.size() > TAIL_BYTES) {
+            _tail.erase(0, _tail.size() - TAIL_BYTES);
+        }
+    }
+    _reported = UNCHANGED;
+    return true;
+}
+
+bool FileWatcher::read_events() {
+    if (_watch < 0) {
+        return true;
+    }
+    bool any(false);
+#ifdef FILE_WATCHER_INOTIFY
+    // what the events are doesn't matter: the file's status tells.
+    char events[4096];
+    ssize_t count;
+    while ((count = ::read(_descriptor, events, sizeof(events))) > 0 || (count < 0 && errno == EINTR)) {
+        any = any || count > 0;
+    }
+#endif
+    _touched = _touched || any;
+    return any;
+}
+
+FileWatcher::Status FileWatcher::status_of(const struct stat& info) {
+    Status status;
+    status.exists = true;
+    status.device = info.st_dev;
+    status.inode = info.st_ino;
+    status.size = info.st_size;
+#ifdef __APPLE__
+    status.modified_seconds = info.st_mtimespec.tv_sec;
+    status.modified_nanoseconds = info.st_mtimespec.tv_nsec;
+#else
+    status.modified_seconds = info.st_mtim.tv_sec;
+    status.modified_nanoseconds = info.st_mtim.tv_nsec;
+#endif
+    return status;
+}
+
+FileWatcher::Status FileWatcher::status_of(const string& filename) {
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) {
+        return Status();
+    }
+    return status_of(info);
+}
+
+bool FileWatcher::same(const Status& first, const Status& second) {
+    return first.exists == second.exists && first.device == second.device && first.inode == second.inode
+        && first.size == second.size && first.modified_seconds == second.modified_seconds
+        && first.modified_nanoseconds == second.modified_nanoseconds;
+}
+
+bool FileWatcher::read_at(const int descriptor, const size_t offset, const size_t length, string& output) {
+    const size_t start = output.size();
+    output.resize(start + length);
+    size_t done(0);
+    while (done < length) {
+        const ssize_t count = pread(descriptor, &output[start + done], length - done, offset + done);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            output.resize(start);
+            return false;
+        }
+        done += count;
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef FileWatcher_h
+#define FileWatcher_h
+
+#include <string>
+
+using namespace std;
+
+struct stat;
+
+/**
+ * Tells whether a file changed on disk since it was last read or
+ * written, and whether bytes were only appended to it (as a service
+ * does to its log), in which case they can be read on their own.
+ *
+ * On Linux, inotify tells when to look: until it reports an event,
+ * checking costs one read on a non-blocking descriptor. Elsewhere (or
+ * when the file can't be watched), the file's status is read every time.
+ */
+class FileWatcher {
+public:
+    enum Change {
+        UNCHANGED,
+        /** Bytes were appended, the ones read before are the same. */
+        GROWN,
+        /** Changed in any other way: rewritten, truncated, another file moved there... */
+        REPLACED,
+        REMOVED
+    };
+
+    /**
+     * Bytes kept from the end of the file, compared again to tell
+     * an append from any other change.
+     */
+    static const size_t TAIL_BYTES = 4096;
+
+private:
+    /**
+     * What identifies the content of the file: an append changes the
+     * size and modification time, but not the device and inode.
+     */
+    struct Status {
+        bool exists;
+        unsigned long long device, inode, size;
+        long long modified_seconds, modified_nanoseconds;
+    };
+
+    string _filename;
+
+    /**
+     * The inotify instance and the watch on the file, -1 without them.
+     */
+    int _descriptor;
+    int _watch;
+
+    /**
+     * Set once inotify reported an event since the file was last read.
+     */
+    bool _touched;
+
+    /**
+     * The file as it was last read, and its last TAIL_BYTES bytes.
+     */
+    Status _status;
+    string _tail;
+
+    /**
+     * The last change given to report.
+     */
+    Change _reported;
+
+    static Status status_of(const struct stat& info);
+    static Status status_of(const string& filename);
+    static bool same(const Status& first, const Status& second);
+
+    /**
+     * Reads exactly length bytes at offset, appending them to output.
+     */
+    static bool read_at(const int descriptor, const size_t offset, const size_t length, string& output);
+
+    /**
+     * Takes the events inotify has for the file. Returns true if there was
+     * any, or always when there is no watch: the file may have changed.
+     */
+    bool read_events();
+
+    void close();
+
+public:
+    FileWatcher();
+    ~FileWatcher();
+    FileWatcher(const FileWatcher&)=delete;
+    FileWatcher& operator=(const FileWatcher&)=delete;
+
+    /**
+     * Starts watching the file, taking it as it is now as the one read.
+     * A file that doesn't exist is watched for being created.
+     */
+    void watch(const string& filename);
+
+    /**
+     * The content read is not known (the file changed while it was being
+     * read): any file found there from now on is a replacement.
+     */
+    void forget();
+
+    /**
+     * How the file changed since it was read. With inotify, the file's
+     * status is only read after an event, so it can be called before
+     * every command.
+     */
+    Change check();
+
+    /**
+     * Whether the change (as returned by check) was not reported yet:
+     * each kind of change is only told once, until the file is read again.
+     */
+    bool report(const Change change);
+
+    /**
+     * Whether the file read ended with a newline (or was empty).
+     */
+    bool ends_with_newline() const;
+
+    /**
+     * Reads the bytes appended since the file was read into bytes, which
+     * are then part of what was read. Only valid after check returned
+     * GROWN. Returns false if the file could not be read.
+     */
+    bool read_appended(string& bytes);
+};
+
+#endif /* FileWatcher_h */
@@ -0,0 +1,216 @@
+#include "FileWriter.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include "Stats.h"
+
+const size_t FileWriter::BUFFER_SIZE;
+const size_t FileWriter::MIN_KERNEL_COPY;
+const size_t FileWriter::COMPRESSION_BATCH;
+
+namespace {
+
+mode_t read_umask() {
+    const mode_t mask = umask(0);
+    umask(mask);
+    return mask;
+}
+
+/**
+ * Read once before main: umask can only be read by setting it, which
+ * would race with the threads writing files in the background.
+ */
+const mode_t CREATION_MASK = read_umask();
+
+}
+
+FileWriter::FileWriter() : _descriptor(-1), _buffer(new char[BUFFER_SIZE]), _used(0),
+    _failed(false), _format(Compression::NONE), _level(Compression::DEFAULT_LEVEL) { }
+
+FileWriter::~FileWriter() {
+    if (_descriptor >= 0) { // not committed.
+        ::close(_descriptor);
+        unlink(_temp_filename.c_str());
+    }
+    delete[] _buffer;
+}
+
+bool FileWriter::open(const string& filename, const int level) {
+    _format = Compression::format(filename);
+    _level = level;
+    if (!Compression::supported(_format)) {
+        return false;
+    }
+    _pending.clear();
+    // a link is replaced by the file it names, not by a copy of it.
+    char resolved[PATH_MAX];
+    _filename = realpath(filename.c_str(), resolved) ? string(resolved) : filename;
+    const size_t slash = _filename.rfind('/');
+    const string directory = (slash == string::npos) ? "" : _filename.substr(0, slash + 1);
+    const string base = (slash == string::npos) ? _filename : _filename.substr(slash + 1);
+    vector<char> temp_filename(directory.begin(), directory.end());
+    const string suffix = "." + base + ".XXXXXX";
+    temp_filename.insert(temp_filename.end(), suffix.begin(), suffix.end());
+    temp_filename.push_back('\0');
+    _descriptor = mkstemp(temp_filename.data());
+    if (_descriptor < 0) {
+        return false;
+    }
+    _temp_filename = temp_filename.data();
+    // keep the owner, group and permissions of the file being replaced,
+    // or give a new one the permissions open would have.
+    struct stat info;
+    if (stat(_filename.c_str(), &info) == 0) {
+        if (fchown(_descriptor, info.st_uid, info.st_gid) != 0) {
+            // only allowed for the group and by root: the file is the writer's.
+        }
+        // after fchown, which clears the set-user-ID and set-group-ID bits.
+        fchmod(_descriptor, info.st_mode & 07777);
+    } else {
+        fchmod(_descriptor, 0666 & ~CREATION_MASK);
+    }
+    _used = 0;
+    _failed = false;
+    return true;
+}
+
+void FileWriter::append(const char* data, const size_t length) {
+    if (length > BUFFER_SIZE - _used) {
+        if (length >= BUFFER_SIZE) {
+            flush(data, length);
+            return;
+        }
+        flush();
+    }
+    memcpy(_buffer + _used, data, length);
+    _used += length;
+}
+
+void FileWriter::append_line(const char* data, const size_t length) {
+    append(data, length);
+    if (_used == BUFFER_SIZE) {
+        flush();
+    }
+    _buffer[_used++] = '\n';
+}
+
+void FileWriter::append_from(int descriptor, off_t offset, const char* data, const size_t length) {
+    if (descriptor < 0 || length < MIN_KERNEL_COPY || _format != Compression::NONE) {
+        append(data, length);
+        return;
+    }
+    flush();
+    size_t copied(0);
+#ifdef __linux__
+    // the kernel copies (or shares) the blocks without going through user memory.
+    while (!_failed && copied < length) {
+        loff_t from = offset + copied;
+        ssize_t count = copy_file_range(descriptor, &from, _descriptor, nullptr, length - copied, 0);
+        if (count <= 0) {
+            break;
+        }
+        copied += count;
+        Stats::add(Stats::FILE_WRITTEN, count);
+    }
+    while (!_failed && copied < length) {
+        off_t from = offset + copied;
+        ssize_t count = sendfile(_descriptor, descriptor, &from, length - copied);
+        if (count <= 0) {
+            break;
+        }
+        copied += count;
+        Stats::add(Stats::FILE_WRITTEN, count);
+    }
+#endif
+    if (copied < length) {
+        append(data + copied, length - copied);
+    }
+}
+
+bool FileWriter::commit() {
+    flush();
+    if (_format != Compression::NONE) {
+        write_pending();
+        const string trailer = Compression::trailer(_format);
+        write(trailer.data(), trailer.size());
+    }
+    if (_failed || fsync(_descriptor) != 0) {
+        return false;
+    }
+    const int descriptor = _descriptor;
+    _descriptor = -1;
+    if (::close(descriptor) != 0 || rename(_temp_filename.c_str(), _filename.c_str()) != 0) {
+        unlink(_temp_filename.c_str());
+        return false;
+    }
+    // make the rename itself durable.
+    const size_t slash = _filename.rfind('/');
+    const string directory = (slash == string::npos) ? "." : _filename.substr(0, slash + 1);
+    const int directory_descriptor = ::open(directory.c_str(), O_RDONLY);
+    if (directory_descriptor >= 0) {
+        fsync(directory_descriptor);
+        ::close(directory_descriptor);
+    }
+    return true;
+}
+
+void FileWriter::flush(const char* data, const size_t length) {
+    if (_format == Compression::NONE) {
+        write(data, length);
+        return;
+    }
+    _pending.append(_buffer, _used);
+    if (length > 0) {
+        _pending.append(data, length);
+    }
+    _used = 0;
+    if (_pending.size() >= COMPRESSION_BATCH) {
+        write_pending();
+    }
+}
+
+void FileWriter::write_pending() {
+    string compressed;
+    if (!Compression::compress(_format, _level, _pending.data(), _pending.size(), compressed)) {
+        _failed = true;
+    }
+    _pending.clear();
+    write(compressed.data(), compressed.size());
+}
+
+void FileWriter::write(const char* data, const size_t length) {
+    struct iovec parts[2] = {
+        { _buffer, _used },
+        { const_cast<char*>(data), length }
+    };
+    int first(0);
+    while (!_failed && first < 2) {
+        ssize_t count = writev(_descriptor, parts + first, 2 - first);
+        if (count < 0) {
+            if (errno != EINTR) {
+                _failed = true;
+            }
+            continue;
+        }
+        Stats::add(Stats::FILE_WRITTEN, count);
+        // skip what was written, in case it was only partially.
+        for (; first < 2 && static_cast<size_t>(count) >= parts[first].iov_len; ++first) {
+            count -= parts[first].iov_len;
+        }
+        if (first < 2) {
+            parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + count;
+            parts[first].iov_len -= count;
+        }
+    }
+    _used = 0;
+}
@@ -0,0 +1,111 @@
+#ifndef FileWriter_h
+#define FileWriter_h
+
+#include <string>
+#include <sys/types.h>
+#include "Compression.h"
+
+using namespace std;
+
+/**
+ * Writes a file safely and with few system calls.
+ * Everything goes to a temporary file next to the target, through a
+ * large buffer; commit() then syncs it to disk and renames it over the
+ * target, so the target is never left half written. A symbolic link is
+ * followed to the file it names, which keeps its owner, group and
+ * permissions. The target is never written in place, even when it has
+ * other hard links (these keep naming the old content): a buffer may
+ * still be reading its lines from a mapping of it.
+ * Files named as compressed (see Compression) are compressed in large
+ * batches spread over all cores.
+ */
+class FileWriter {
+private:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    /**
+     * Ranges copied from another file at least that big skip the
+     * buffer and are copied by the kernel.
+     */
+    static const size_t MIN_KERNEL_COPY = 1 << 16;
+
+    /**
+     * Bytes collected before compressing them.
+     */
+    static const size_t COMPRESSION_BATCH = 64 << 20;
+
+    /**
+     * The target with symbolic links resolved, and the temporary file
+     * created next to it with a unique name.
+     */
+    string _filename;
+    string _temp_filename;
+    int _descriptor;
+    char* _buffer;
+    size_t _used;
+
+    /**
+     * Set on the first error, after which nothing more is written.
+     */
+    bool _failed;
+
+    Compression::Format _format;
+    int _level;
+
+    /**
+     * Bytes not compressed yet.
+     */
+    string _pending;
+
+    /**
+     * Writes the buffered bytes followed by the given ones, or collects
+     * them to be compressed when the file is compressed.
+     */
+    void flush(const char* data=nullptr, const size_t length=0);
+
+    /**
+     * Writes the buffered bytes followed by the given ones
+     * with a single writev. Sets _failed on error.
+     */
+    void write(const char* data=nullptr, const size_t length=0);
+
+    /**
+     * Compresses and writes the pending bytes.
+     */
+    void write_pending();
+
+public:
+    FileWriter();
+    ~FileWriter();
+    FileWriter(const FileWriter&)=delete;
+    FileWriter& operator=(const FileWriter&)=delete;
+
+    /**
+     * Creates the temporary file for the given target, compressed at the
+     * given level if its name says so. Returns false if it could not be
+     * created or this build can't write its format.
+     */
+    bool open(const string& filename, const int level=Compression::DEFAULT_LEVEL);
+
+    void append(const char* data, const size_t length);
+
+    /**
+     * Appends the line followed by a newline.
+     */
+    void append_line(const char* data, const size_t length);
+
+    /**
+     * Appends length bytes of the given open file, starting at offset.
+     * data must point to those same bytes in memory (e.g. a mapping of the
+     * file), it is used for small ranges or if the kernel can't copy.
+     */
+    void append_from(int descriptor, off_t offset, const char* data, const size_t length);
+
+    /**
+     * Flushes, syncs and moves the file over the target.
+     * Returns false if anything failed; the target is then left as it was.
+     */
+    bool commit();
+};
+
+#endif /* FileWriter_h */
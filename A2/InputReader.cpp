@@ -0,0 +1,121 @@
+#include "InputReader.h"
+#include <cctype>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "Stats.h"
+
+const size_t InputReader::CHUNK_SIZE;
+
+InputReader::InputReader(istream& stream) :
+_stream(&stream), _descriptor(&stream == &cin ? STDIN_FILENO : -1), _begin(0), _end(0), _ended(false) { }
+
+void InputReader::reset(istream& stream) {
+    _stream = &stream;
+    _descriptor = &stream == &cin ? STDIN_FILENO : -1;
+    _begin = _end = 0;
+    _ended = false;
+}
+
+bool InputReader::fill() {
+    if (_ended) {
+        return false;
+    }
+    if (_begin == _end) {
+        _begin = _end = 0;
+    } else if (_begin > 0 && _end == _buffer.size()) {
+        memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+        _end -= _begin;
+        _begin = 0;
+    }
+    if (_end == _buffer.size()) {
+        // a line longer than the buffer.
+        _buffer.resize(max(CHUNK_SIZE, 2 * _buffer.size()));
+    }
+    // prompts must show before waiting for the answer.
+    if (_stream->tie()) {
+        _stream->tie()->flush();
+    }
+    ssize_t count;
+    if (_descriptor >= 0) {
+        while ((count = ::read(_descriptor, _buffer.data() + _end, _buffer.size() - _end)) < 0 && errno == EINTR) { }
+    } else {
+        _stream->read(_buffer.data() + _end, _buffer.size() - _end);
+        count = _stream->gcount();
+    }
+    if (count <= 0) {
+        _ended = true;
+        return false;
+    }
+    _end += count;
+    return true;
+}
+
+bool InputReader::getline(string& line) {
+    line.clear();
+    bool found(false);
+    while (_begin < _end || fill()) {
+        found = true;
+        const char* first = _buffer.data() + _begin;
+        const char* newline = static_cast<const char*>(memchr(first, '\n', _end - _begin));
+        if (newline) {
+            line.append(first, newline - first);
+            _begin += newline - first + 1;
+            return true;
+        }
+        line.append(first, _end - _begin);
+        _begin = _end;
+    }
+    return found;
+}
+
+bool InputReader::word(string& word) {
+    word.clear();
+    while (_begin < _end || fill()) {
+        const char character = _buffer[_begin];
+        if (isspace(static_cast<unsigned char>(character))) {
+            if (!word.empty()) {
+                return true;
+            }
+        } else {
+            word.push_back(character);
+        }
+        ++_begin;
+    }
+    return !word.empty();
+}
+
+void InputReader::read_lines(LineBatch& lines, const bool ignore_period) {
+    Stats::Timer timer(Stats::READ_LINES);
+    while (_begin < _end || fill()) {
+        const char* first = _buffer.data() + _begin;
+        const char* last = _buffer.data() + _end;
+        const char* end = lines.push_lines(first, last, !ignore_period);
+        Stats::add(Stats::INPUT_READ, end - first);
+        _begin += end - first;
+        if (last - end >= 2 && end[0] == '.' && end[1] == '\n') {
+            // the line ending the text.
+            _begin += 2;
+            return;
+        }
+        if (end == last || fill()) {
+            continue;
+        }
+        // the last line has no newline.
+        if (ignore_period || _end - _begin != 1 || _buffer[_begin] != '.') {
+            lines.push_back(_buffer.data() + _begin, _end - _begin);
+            Stats::add(Stats::INPUT_READ, _end - _begin);
+        }
+        _begin = _end;
+        return;
+    }
+}
+
+bool InputReader::good() const {
+    return !_ended;
+}
+
+istream& InputReader::stream() const {
+    return *_stream;
+}
@@ -0,0 +1,87 @@
+#ifndef InputReader_h
+#define InputReader_h
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "LineBatch.h"
+
+using namespace std;
+
+/**
+ * Reads the editor's input (commands, the text for the append, insert
+ * and change commands, answers to questions) in large chunks.
+ * Standard input is read straight from its descriptor, which returns
+ * whatever is available: a line at a time from a terminal, a whole
+ * chunk of a paste or a pipe. Text read in bulk is split into lines
+ * in the chunk and added to a LineBatch without a copy per line.
+ *
+ * All the reads from a stream must go through the same reader,
+ * since it reads ahead of what it returns.
+ */
+class InputReader {
+private:
+    static const size_t CHUNK_SIZE = 1 << 20;
+
+    istream* _stream;
+
+    /**
+     * The descriptor read when the stream is standard input, -1 otherwise.
+     */
+    int _descriptor;
+
+    /**
+     * The bytes read but not returned yet are [_begin, _end).
+     */
+    vector<char> _buffer;
+    size_t _begin;
+    size_t _end;
+
+    /**
+     * Set once the end of the input (or an error) is reached.
+     */
+    bool _ended;
+
+    /**
+     * Reads more bytes after the ones not returned yet.
+     * Returns false at the end of the input.
+     */
+    bool fill();
+
+public:
+    explicit InputReader(istream& stream);
+
+    /**
+     * Reads from another stream, dropping what was read ahead
+     * from the previous one (the buffer is kept).
+     */
+    void reset(istream& stream);
+
+    /**
+     * Like std::getline: reads up to the next newline, returns false if
+     * nothing was left to read.
+     */
+    bool getline(string& line);
+
+    /**
+     * Like operator>>: skips whitespace and reads up to the next one,
+     * returns false if nothing but whitespace was left to read.
+     */
+    bool word(string& word);
+
+    /**
+     * Reads lines into the batch until one that is only a period
+     * (which is dropped), or to the end of the input with ignore_period.
+     */
+    void read_lines(LineBatch& lines, const bool ignore_period=false);
+
+    /**
+     * False once the end of the input was reached,
+     * even if the last read returned something.
+     */
+    bool good() const;
+
+    istream& stream() const;
+};
+
+#endif /* InputReader_h */
@@ -0,0 +1,611 @@
+#include "JournaledBuffer.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Stats.h"
+
+const char JournaledBuffer::MAGIC[8] = { 'L', 'E', 'D', 'J', 'R', 'N', 'L', '1' };
+const size_t JournaledBuffer::MAX_PENDING;
+const chrono::milliseconds JournaledBuffer::SYNC_INTERVAL(1000);
+
+namespace {
+
+const uint32_t FNV_OFFSET = 2166136261u;
+const uint32_t FNV_PRIME = 16777619u;
+
+const size_t CHECKSUM_SIZE = 4;
+
+/**
+ * Reads the numbers (LEB128) and texts written in the journal,
+ * failing instead of reading past the end.
+ */
+class Reader {
+private:
+    const char* _position;
+    const char* const _end;
+
+public:
+    Reader(const char* position, const char* end) : _position(position), _end(end) { }
+
+    const char* position() const {
+        return _position;
+    }
+
+    bool byte(unsigned char& value) {
+        if (_position == _end)
+            return false;
+        value = *_position++;
+        return true;
+    }
+
+    bool number(unsigned long long& value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            unsigned char part;
+            if (!byte(part))
+                return false;
+            value |= static_cast<unsigned long long>(part & 0x7f) << shift;
+            if (!(part & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool text(const char*& data, size_t& length) {
+        unsigned long long size;
+        if (!number(size) || size > static_cast<size_t>(_end - _position))
+            return false;
+        data = _position;
+        length = size;
+        _position += size;
+        return true;
+    }
+
+    bool skip(const size_t length) {
+        if (length > static_cast<size_t>(_end - _position))
+            return false;
+        _position += length;
+        return true;
+    }
+};
+
+void put_number(string& output, unsigned long long number) {
+    while (number >= 0x80) {
+        output.push_back(static_cast<char>((number & 0x7f) | 0x80));
+        number >>= 7;
+    }
+    output.push_back(static_cast<char>(number));
+}
+
+/**
+ * Syncs the file data (not necessarily its metadata) to disk.
+ */
+int sync_data(int descriptor) {
+#ifdef __APPLE__
+    return fsync(descriptor);
+#else
+    return fdatasync(descriptor);
+#endif
+}
+
+/**
+ * Makes the names of the files in the directory of path durable.
+ */
+void sync_directory(const string& path) {
+    const size_t slash = path.rfind('/');
+    const string directory = (slash == string::npos) ? "." : path.substr(0, slash + 1);
+    const int directory_descriptor = ::open(directory.c_str(), O_RDONLY);
+    if (directory_descriptor >= 0) {
+        fsync(directory_descriptor);
+        ::close(directory_descriptor);
+    }
+}
+
+bool write_all(int descriptor, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t count = ::write(descriptor, data, length);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += count;
+        length -= count;
+    }
+    return true;
+}
+
+}
+
+JournaledBuffer::JournaledBuffer(Buffer* buffer, const string& path) :
+_buffer(buffer), _path(path), _identity(), _descriptor(-1), _checksum(FNV_OFFSET), _started(false),
+_failed(false), _journaled(0), _base(0), _header_size(0), _unsynced(false), _recoverable(false) { }
+
+JournaledBuffer::~JournaledBuffer() {
+    close();
+}
+
+bool JournaledBuffer::load(const string& filename) {
+    const bool loaded = _buffer->load(filename);
+    _filename = filename;
+    _identity = identify(filename);
+
+    // only the header is needed to know if the journal is for this file.
+    _recoverable = false;
+    const int descriptor = ::open(_path.c_str(), O_RDONLY);
+    if (descriptor >= 0) {
+        char header[64];
+        const ssize_t count = ::read(descriptor, header, sizeof(header));
+        ::close(descriptor);
+        const char* position = header;
+        _recoverable = count > 0 && read_header(position, header + count)
+                       && position < header + count;
+    }
+    return loaded;
+}
+
+size_t JournaledBuffer::invalid_lines(size_t& first) const {
+    return _buffer->invalid_lines(first);
+}
+
+bool JournaledBuffer::truncated() {
+    return _buffer->truncated();
+}
+
+size_t JournaledBuffer::size() const {
+    return _buffer->size();
+}
+
+string JournaledBuffer::line(const size_t index) const {
+    return _buffer->line(index);
+}
+
+void JournaledBuffer::for_each(const size_t from, const size_t to, const LineVisitor& visitor) const {
+    _buffer->for_each(from, to, visitor);
+}
+
+void JournaledBuffer::insert(const size_t index, const LineBatch& lines) {
+    _buffer->insert(index, lines);
+    if (lines.empty()) {
+        return;
+    }
+    append_record(INSERT);
+    append_number(index);
+    append_number(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        append_text(lines.data(i), lines.length(i));
+    }
+}
+
+void JournaledBuffer::replace(const size_t index, const string& line) {
+    _buffer->replace(index, line);
+    append_record(REPLACE);
+    append_number(index);
+    append_text(line.data(), line.size());
+}
+
+void JournaledBuffer::erase(const size_t from, const size_t to) {
+    _buffer->erase(from, to);
+    append_record(ERASE);
+    append_number(from);
+    append_number(to);
+}
+
+unique_ptr<Buffer::Lines> JournaledBuffer::copy(const size_t from, const size_t to) const {
+    return _buffer->copy(from, to);
+}
+
+unique_ptr<Buffer::Lines> JournaledBuffer::cut(const size_t from, const size_t to) {
+    if (from < to) {
+        append_record(ERASE);
+        append_number(from);
+        append_number(to);
+    }
+    return _buffer->cut(from, to);
+}
+
+void JournaledBuffer::insert(const size_t index, const Lines& lines) {
+    _buffer->insert(index, lines);
+    if (lines.size() == 0) {
+        return;
+    }
+    // the lines are only known to the buffer: the journal gets their text.
+    append_record(INSERT);
+    append_number(index);
+    append_number(lines.size());
+    _buffer->for_each(index, index + lines.size(), [this](const char* data, size_t length) {
+        append_text(data, length);
+    });
+}
+
+void JournaledBuffer::move_lines(const size_t from, const size_t to, const size_t index) {
+    _buffer->move_lines(from, to, index);
+    if (from == to || (index >= from && index <= to)) {
+        return;
+    }
+    append_record(MOVE);
+    append_number(from);
+    append_number(to);
+    append_number(index);
+}
+
+void JournaledBuffer::copy_lines(const size_t from, const size_t to, const size_t index) {
+    _buffer->copy_lines(from, to, index);
+    if (from == to) {
+        return;
+    }
+    append_record(COPY);
+    append_number(from);
+    append_number(to);
+    append_number(index);
+}
+
+void JournaledBuffer::write_to(FileWriter& writer) const {
+    _buffer->write_to(writer);
+}
+
+unique_ptr<Buffer> JournaledBuffer::snapshot() const {
+    return _buffer->snapshot();
+}
+
+bool JournaledBuffer::recoverable() const {
+    return _recoverable;
+}
+
+bool JournaledBuffer::recover(size_t& current) {
+    _recoverable = false;
+    const int descriptor = ::open(_path.c_str(), O_RDWR);
+    if (descriptor < 0) {
+        return false;
+    }
+    string journal;
+    char chunk[1 << 16];
+    ssize_t count;
+    while ((count = ::read(descriptor, chunk, sizeof(chunk))) > 0 || (count < 0 && errno == EINTR)) {
+        if (count > 0)
+            journal.append(chunk, count);
+    }
+    const char* const data = journal.data();
+    const char* const end = data + journal.size();
+    const char* start = data;
+    if (count < 0 || !read_header(start, end)) {
+        ::close(descriptor);
+        return false;
+    }
+
+    // First find the last complete command, checking that every edit
+    // fits in the buffer, then apply the edits up to it.
+    Reader reader(start, end);
+    const char* valid_end = start;
+    const char* command = start;
+    unsigned long long lines = _buffer->size();
+    while (true) {
+        unsigned char record;
+        unsigned long long first, second;
+        const char* text;
+        size_t length;
+        bool valid = reader.byte(record) && reader.number(first);
+        if (!valid) {
+            break;
+        }
+        if (record == INSERT) {
+            valid = first <= lines && reader.number(second);
+            for (unsigned long long i = 0; valid && i < second; ++i) {
+                valid = reader.text(text, length);
+            }
+            lines += second;
+        } else if (record == REPLACE) {
+            valid = first < lines && reader.text(text, length);
+        } else if (record == ERASE) {
+            valid = reader.number(second) && first <= second && second <= lines;
+            lines -= second - first;
+        } else if (record == MOVE || record == COPY) {
+            unsigned long long index;
+            valid = reader.number(second) && reader.number(index) && first <= second && second <= lines
+                && index <= lines;
+            if (record == COPY) {
+                lines += second - first;
+            }
+        } else if (record == COMMIT) {
+            const char* const checked = reader.position();
+            uint32_t stored(0);
+            valid = reader.skip(CHECKSUM_SIZE);
+            if (valid) {
+                memcpy(&stored, checked, CHECKSUM_SIZE);
+                valid = stored == checksum(FNV_OFFSET, command, checked - command);
+            }
+            if (valid) {
+                valid_end = command = reader.position();
+            }
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            break;
+        }
+    }
+
+    Reader replay(start, valid_end);
+    unsigned char record;
+    while (replay.byte(record)) {
+        unsigned long long first, second;
+        const char* text;
+        size_t length;
+        replay.number(first);
+        if (record == INSERT) {
+            replay.number(second);
+            LineBatch inserted;
+            for (unsigned long long i = 0; i < second; ++i) {
+                replay.text(text, length);
+                inserted.push_back(text, length);
+            }
+            _buffer->insert(first, inserted);
+        } else if (record == REPLACE) {
+            replay.text(text, length);
+            _buffer->replace(first, string(text, length));
+        } else if (record == ERASE) {
+            replay.number(second);
+            _buffer->erase(first, second);
+        } else if (record == MOVE || record == COPY) {
+            unsigned long long index;
+            replay.number(second);
+            replay.number(index);
+            if (record == MOVE) {
+                _buffer->move_lines(first, second, index);
+            } else {
+                _buffer->copy_lines(first, second, index);
+            }
+        } else { // COMMIT
+            replay.skip(CHECKSUM_SIZE);
+            current = first;
+        }
+    }
+
+    // an incomplete command at the end is dropped, new ones go after.
+    if (ftruncate(descriptor, valid_end - data) != 0 || lseek(descriptor, 0, SEEK_END) < 0) {
+        ::close(descriptor);
+        _failed = true;
+    } else {
+        _descriptor = descriptor;
+        _header_size = start - data;
+        _base = _journaled;
+        _journaled += valid_end - start;
+    }
+    return valid_end != start;
+}
+
+void JournaledBuffer::commit(const size_t current) {
+    if (_pending.empty() && !_started) {
+        return;
+    }
+    append_record(COMMIT);
+    append_number(current);
+    _checksum = checksum(_checksum, _pending.data(), _pending.size());
+    _pending.append(reinterpret_cast<const char*>(&_checksum), CHECKSUM_SIZE);
+    write_pending();
+    _checksum = FNV_OFFSET;
+    _started = false;
+    lock_guard<mutex> lock(_mutex);
+    if (_unsynced && chrono::steady_clock::now() - _last_sync >= SYNC_INTERVAL) {
+        sync();
+    }
+}
+
+void JournaledBuffer::write_pending() {
+    lock_guard<mutex> lock(_mutex);
+    if (!_failed && (_descriptor >= 0 || create(_path))) {
+        if (write_all(_descriptor, _pending.data(), _pending.size())) {
+            Stats::add(Stats::JOURNAL_WRITTEN, _pending.size());
+            _unsynced = true;
+        } else {
+            ::close(_descriptor);
+            _descriptor = -1;
+            _failed = true;
+        }
+    }
+    _journaled += _pending.size();
+    _pending.clear();
+}
+
+void JournaledBuffer::restart() {
+    discard();
+    lock_guard<mutex> lock(_mutex);
+    _identity = identify(_filename);
+}
+
+size_t JournaledBuffer::mark() const {
+    return _journaled + _pending.size();
+}
+
+void JournaledBuffer::restart(const size_t mark) {
+    lock_guard<mutex> lock(_mutex);
+    restart_from(mark);
+}
+
+void JournaledBuffer::follow_append() {
+    lock_guard<mutex> lock(_mutex);
+    const Identity now = identify(_filename);
+    if (now.exists == _identity.exists && now.size == _identity.size
+        && now.modified_seconds == _identity.modified_seconds
+        && now.modified_nanoseconds == _identity.modified_nanoseconds) {
+        return;
+    }
+    // all the records written so far move to a journal for the file as it is.
+    restart_from(_base);
+}
+
+void JournaledBuffer::restart_from(const size_t mark) {
+    // only the journal file is touched here: the records of the command
+    // being run, if any, are written to it later as usual.
+    if (_descriptor < 0 || mark < _base) {
+        // no journal file, or one started after mark: it is kept as is.
+        if (_descriptor < 0) {
+            _identity = identify(_filename);
+        }
+        return;
+    }
+    if (mark == _journaled) {
+        // nothing written since mark: the next records start a new journal.
+        ::close(_descriptor);
+        _descriptor = -1;
+        _unsynced = false;
+        unlink(_path.c_str());
+        _identity = identify(_filename);
+        return;
+    }
+    // the records since mark go to a new journal, which then replaces this one.
+    string kept;
+    const int reader = ::open(_path.c_str(), O_RDONLY);
+    off_t position = _header_size + (mark - _base);
+    char chunk[1 << 16];
+    ssize_t count(-1);
+    while (reader >= 0 && ((count = pread(reader, chunk, sizeof(chunk), position)) > 0 || (count < 0 && errno == EINTR))) {
+        if (count > 0) {
+            kept.append(chunk, count);
+            position += count;
+        }
+    }
+    if (reader >= 0) {
+        ::close(reader);
+    }
+    ::close(_descriptor);
+    _descriptor = -1;
+    if (count < 0) {
+        _failed = true;
+        return;
+    }
+    _identity = identify(_filename);
+    const string temporary = _path + ".new";
+    if (!create(temporary)) {
+        return;
+    }
+    if (!write_all(_descriptor, kept.data(), kept.size()) || sync_data(_descriptor) != 0
+        || rename(temporary.c_str(), _path.c_str()) != 0) {
+        ::close(_descriptor);
+        _descriptor = -1;
+        unlink(temporary.c_str());
+        _failed = true;
+        return;
+    }
+    Stats::add(Stats::JOURNAL_WRITTEN, kept.size());
+    sync_directory(_path);
+    _base = mark;
+    _unsynced = false;
+    _last_sync = chrono::steady_clock::now();
+}
+
+void JournaledBuffer::discard() {
+    lock_guard<mutex> lock(_mutex);
+    if (_descriptor >= 0) {
+        ::close(_descriptor);
+        _descriptor = -1;
+    }
+    _unsynced = false;
+    _pending.clear();
+    _checksum = FNV_OFFSET;
+    _started = false;
+    _recoverable = false;
+    unlink(_path.c_str());
+}
+
+JournaledBuffer::Identity JournaledBuffer::identify(const string& filename) {
+    Identity identity = { false, 0, 0, 0 };
+    struct stat info;
+    if (stat(filename.c_str(), &info) == 0) {
+        identity.exists = true;
+        identity.size = info.st_size;
+#ifdef __APPLE__
+        identity.modified_seconds = info.st_mtimespec.tv_sec;
+        identity.modified_nanoseconds = info.st_mtimespec.tv_nsec;
+#else
+        identity.modified_seconds = info.st_mtim.tv_sec;
+        identity.modified_nanoseconds = info.st_mtim.tv_nsec;
+#endif
+    }
+    return identity;
+}
+
+uint32_t JournaledBuffer::checksum(uint32_t hash, const char* data, const size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * FNV_PRIME;
+    }
+    return hash;
+}
+
+bool JournaledBuffer::read_header(const char*& position, const char* end) const {
+    Reader reader(position, end);
+    unsigned long long exists, size, seconds, nanoseconds;
+    if (!reader.skip(sizeof(MAGIC)) || memcmp(position, MAGIC, sizeof(MAGIC)) != 0
+        || !reader.number(exists) || !reader.number(size)
+        || !reader.number(seconds) || !reader.number(nanoseconds)) {
+        return false;
+    }
+    position = reader.position();
+    return (exists != 0) == _identity.exists && size == _identity.size
+        && static_cast<long long>(seconds) == _identity.modified_seconds
+        && static_cast<long long>(nanoseconds) == _identity.modified_nanoseconds;
+}
+
+void JournaledBuffer::append_record(const Record record) {
+    _pending.push_back(static_cast<char>(record));
+}
+
+void JournaledBuffer::append_number(unsigned long long number) {
+    put_number(_pending, number);
+}
+
+void JournaledBuffer::append_text(const char* data, const size_t length) {
+    put_number(_pending, length);
+    _pending.append(data, length);
+    if (_pending.size() >= MAX_PENDING) {
+        // a big command is written as it goes, not held in memory:
+        // without its commit record, it is ignored on recovery.
+        _checksum = checksum(_checksum, _pending.data(), _pending.size());
+        write_pending();
+        _started = true;
+    }
+}
+
+bool JournaledBuffer::create(const string& path) {
+    _descriptor = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (_descriptor < 0) {
+        _failed = true;
+        return false;
+    }
+    string header(MAGIC, sizeof(MAGIC));
+    put_number(header, _identity.exists);
+    put_number(header, _identity.size);
+    put_number(header, _identity.modified_seconds);
+    put_number(header, _identity.modified_nanoseconds);
+    if (!write_all(_descriptor, header.data(), header.size())) {
+        ::close(_descriptor);
+        _descriptor = -1;
+        _failed = true;
+        return false;
+    }
+    Stats::add(Stats::JOURNAL_WRITTEN, header.size());
+    _header_size = header.size();
+    _base = _journaled;
+    // make the journal's name durable once, the data is synced later.
+    sync_directory(path);
+    return true;
+}
+
+void JournaledBuffer::sync() {
+    if (_descriptor >= 0 && _unsynced) {
+        sync_data(_descriptor);
+    }
+    _unsynced = false;
+    _last_sync = chrono::steady_clock::now();
+}
+
+void JournaledBuffer::close() {
+    lock_guard<mutex> lock(_mutex);
+    if (_descriptor >= 0) {
+        sync();
+        ::close(_descriptor);
+        _descriptor = -1;
+    }
+}
@@ -0,0 +1,223 @@
+#ifndef JournaledBuffer_h
+#define JournaledBuffer_h
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "Buffer.h"
+
+using namespace std;
+
+/**
+ * Buffer that forwards everything to another buffer and records every
+ * change made to it in a journal file next to the edited file, so the
+ * changes not written yet can be recovered if the editor dies.
+ *
+ * The journal holds the edits themselves (lines inserted, replaced or
+ * erased), not the commands, so replaying it never searches or reads the
+ * input again: it takes as long as reading the journal. Lines moved or
+ * copied are recorded by their ranges, not their text. Each command's
+ * edits end with a commit record carrying a checksum; a command cut short
+ * by a crash is dropped as a whole on recovery.
+ *
+ * The edits are written to the file at the end of every command, so a
+ * crash of the editor loses nothing. Syncing to disk is batched: at most
+ * once per SYNC_INTERVAL, and when the editor stops.
+ */
+class JournaledBuffer : public Buffer {
+private:
+    enum Record : unsigned char {
+        INSERT = 'I',
+        REPLACE = 'C',
+        ERASE = 'E',
+        MOVE = 'M',
+        COPY = 'T',
+        COMMIT = 'K'
+    };
+
+    static const char MAGIC[8];
+
+    static const chrono::milliseconds SYNC_INTERVAL;
+
+    /**
+     * The records of a command are written once they reach that size,
+     * before the command ends.
+     */
+    static const size_t MAX_PENDING = 1 << 20;
+
+    unique_ptr<Buffer> _buffer;
+    const string _path;
+
+    /**
+     * What the edited file looked like when the journal started:
+     * a journal only applies to that exact file.
+     */
+    struct Identity {
+        bool exists;
+        unsigned long long size;
+        long long modified_seconds;
+        long long modified_nanoseconds;
+    };
+    Identity _identity;
+
+    /**
+     * The file being edited, to know it again after it is written.
+     */
+    string _filename;
+
+    /**
+     * The journal file, opened on the first change.
+     */
+    int _descriptor;
+
+    /**
+     * Records of the command being run not written yet, and the
+     * checksum of the ones already written (_started is then set).
+     */
+    string _pending;
+    uint32_t _checksum;
+    bool _started;
+
+    /**
+     * Set when the journal could not be created or written:
+     * editing goes on without it.
+     */
+    bool _failed;
+
+    /**
+     * Bytes of records journaled since the buffer was created (see mark),
+     * the value it had when the journal file was started, and the size
+     * of that file's header: the records journaled at mark start at
+     * _header_size + mark - _base in the file.
+     */
+    size_t _journaled;
+    size_t _base;
+    size_t _header_size;
+
+    bool _unsynced;
+    chrono::steady_clock::time_point _last_sync;
+
+    /**
+     * Guards the journal file (and what describes it) against
+     * restart(mark), which is called by the thread writing a snapshot.
+     */
+    mutex _mutex;
+
+    /**
+     * Set by load when a journal for the loaded file was found.
+     */
+    bool _recoverable;
+
+    static Identity identify(const string& filename);
+    static uint32_t checksum(uint32_t hash, const char* data, const size_t length);
+
+    /**
+     * Reads the journal header at position, moving past it.
+     * Returns true if it is a journal for the file as it is now.
+     */
+    bool read_header(const char*& position, const char* end) const;
+
+    void append_record(const Record record);
+    void append_number(unsigned long long number);
+    void append_text(const char* data, const size_t length);
+
+    /**
+     * Creates the journal file at path and writes its header. Returns false
+     * if it could not be created (the edits are then not journaled).
+     */
+    bool create(const string& path);
+
+    /**
+     * Writes the pending records, creating the journal if needed.
+     */
+    void write_pending();
+
+    void sync();
+    void close();
+
+    /**
+     * restart(mark), with _mutex held.
+     */
+    void restart_from(const size_t mark);
+
+public:
+    /**
+     * Takes ownership of the buffer. The journal is kept at path.
+     */
+    JournaledBuffer(Buffer* buffer, const string& path);
+    ~JournaledBuffer();
+    JournaledBuffer(const JournaledBuffer&)=delete;
+    JournaledBuffer& operator=(const JournaledBuffer&)=delete;
+
+    /**
+     * Loads the file and looks for a journal left for it.
+     */
+    bool load(const string& filename) override;
+    size_t invalid_lines(size_t& first) const override;
+    bool truncated() override;
+    size_t size() const override;
+    string line(const size_t index) const override;
+    void for_each(const size_t from, const size_t to, const LineVisitor& visitor) const override;
+    void insert(const size_t index, const LineBatch& lines) override;
+    void replace(const size_t index, const string& line) override;
+    void erase(const size_t from, const size_t to) override;
+    unique_ptr<Lines> copy(const size_t from, const size_t to) const override;
+    unique_ptr<Lines> cut(const size_t from, const size_t to) override;
+    void insert(const size_t index, const Lines& lines) override;
+    void move_lines(const size_t from, const size_t to, const size_t index) override;
+    void copy_lines(const size_t from, const size_t to, const size_t index) override;
+    void write_to(FileWriter& writer) const override;
+    unique_ptr<Buffer> snapshot() const override;
+
+    /**
+     * True if load found a journal with changes to the file.
+     */
+    bool recoverable() const;
+
+    /**
+     * Applies the changes found in the journal to the buffer and keeps
+     * journaling after them. current is set to the current line saved
+     * with the last complete command. Returns false if nothing could be
+     * recovered.
+     */
+    bool recover(size_t& current);
+
+    /**
+     * Ends a command: its edits and the current line are written
+     * to the journal, synced if the last sync is old enough.
+     */
+    void commit(const size_t current);
+
+    /**
+     * The file was written: the journal restarts from it.
+     */
+    void restart();
+
+    /**
+     * Where the journal is: changes since mark() change its value.
+     */
+    size_t mark() const;
+
+    /**
+     * The buffer as it was at mark was written (from a snapshot): the
+     * journal restarts from the file, keeping the edits made since.
+     * Can be called from another thread while the buffer is edited.
+     */
+    void restart(const size_t mark);
+
+    /**
+     * The file was only appended to: the journal now applies to it as
+     * it is, its edits still being those of the lines it had. Nothing
+     * is done if the file didn't change since.
+     */
+    void follow_append();
+
+    /**
+     * Removes the journal, its changes are no longer needed.
+     */
+    void discard();
+};
+
+#endif /* JournaledBuffer_h */
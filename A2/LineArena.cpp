@@ -0,0 +1,36 @@
+#include "LineArena.h"
+#include <algorithm>
+#include <cstring>
+
+const size_t LineArena::SLAB_BITS;
+const size_t LineArena::SLAB_SIZE;
+
+LineArena::LineArena() : _used(SLAB_SIZE) { }
+
+size_t LineArena::add(const char* data, const size_t length) {
+    if (length > SLAB_SIZE - _used || _slabs.empty()) {
+        const size_t slabs = max<size_t>(1, (length + SLAB_SIZE - 1) / SLAB_SIZE);
+        const size_t first = _slabs.size();
+        _allocations.push_back(shared_ptr<char>(new char[slabs > 1 ? length : SLAB_SIZE], default_delete<char[]>()));
+        for (size_t i = 0; i < slabs; ++i) {
+            _slabs.push_back(_allocations.back().get() + i * SLAB_SIZE);
+        }
+        _used = 0;
+        if (slabs > 1) {
+            // a long line fills its slabs, the next line starts a new one.
+            memcpy(_slabs[first], data, length);
+            _used = SLAB_SIZE;
+            return first << SLAB_BITS;
+        }
+    }
+    const size_t offset = ((_slabs.size() - 1) << SLAB_BITS) + _used;
+    memcpy(_slabs.back() + _used, data, length);
+    _used += length;
+    return offset;
+}
+
+void LineArena::clear() {
+    _allocations.clear();
+    _slabs.clear();
+    _used = SLAB_SIZE;
+}
@@ -0,0 +1,61 @@
+#ifndef LineArena_h
+#define LineArena_h
+
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Append-only storage for the text of lines, in large slabs that never
+ * move: storing a line is a copy, and allocates only once per slab.
+ * Nothing is freed before clear, so lines removed from a buffer (and
+ * kept for undo) stay valid.
+ *
+ * A line is known by its offset, as if all slabs were one contiguous
+ * string. Each slab covers SLAB_SIZE offsets and a line never spans two
+ * slabs, except lines longer than a slab, which get an allocation of
+ * their own covering as many slabs as needed.
+ *
+ * Copies share the slabs: a copy can read the lines stored up to then
+ * from another thread, whatever the original does afterwards.
+ */
+class LineArena {
+private:
+    static const size_t SLAB_BITS = 20;
+    static const size_t SLAB_SIZE = size_t(1) << SLAB_BITS;
+
+    vector<shared_ptr<char>> _allocations;
+
+    /**
+     * Where each slab's offsets start in memory.
+     */
+    vector<char*> _slabs;
+
+    /**
+     * Bytes used in the last slab.
+     */
+    size_t _used;
+
+public:
+    LineArena();
+
+    /**
+     * Copies the line and returns its offset.
+     */
+    size_t add(const char* data, const size_t length);
+
+    /**
+     * The line stored at the given offset.
+     */
+    const char* data(const size_t offset) const {
+        return _slabs[offset >> SLAB_BITS] + (offset & (SLAB_SIZE - 1));
+    }
+
+    /**
+     * Frees all the slabs.
+     */
+    void clear();
+};
+
+#endif /* LineArena_h */
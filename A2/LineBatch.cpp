@@ -0,0 +1,54 @@
+#include "LineBatch.h"
+#include "NewlineScanner.h"
+
+void LineBatch::push_back(const char* data, const size_t length) {
+    _text.append(data, length);
+    _text.push_back('\n');
+    _ends.push_back(_text.size());
+}
+
+void LineBatch::push_back(const string& line) {
+    push_back(line.data(), line.size());
+}
+
+const char* LineBatch::push_lines(const char* text, const char* last, const bool stop_at_period) {
+    const size_t offset = _text.size();
+    const char* line = text;
+    while (line < last) {
+        size_t found(1);
+        const char* next = NewlineScanner::skip(line, last, found);
+        if (!found || (stop_at_period && next - line == 2 && *line == '.')) {
+            break;
+        }
+        _ends.push_back(offset + (next - text));
+        line = next;
+    }
+    _text.append(text, line - text);
+    return line;
+}
+
+size_t LineBatch::size() const {
+    return _ends.size();
+}
+
+bool LineBatch::empty() const {
+    return _ends.empty();
+}
+
+const char* LineBatch::data(const size_t index) const {
+    return _text.data() + (index ? _ends[index - 1] : 0);
+}
+
+size_t LineBatch::length(const size_t index) const {
+    // without the newline.
+    return _ends[index] - (index ? _ends[index - 1] : 0) - 1;
+}
+
+string LineBatch::line(const size_t index) const {
+    return string(data(index), length(index));
+}
+
+void LineBatch::clear() {
+    _text.clear();
+    _ends.clear();
+}
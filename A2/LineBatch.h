@@ -0,0 +1,51 @@
+#ifndef LineBatch_h
+#define LineBatch_h
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Lines read or built before being inserted in a buffer, stored one
+ * after the other in a single string, each followed by a newline, with
+ * the offset where each ends. Adding a line costs no allocation most of
+ * the time, unlike a string (and a list node) per line, and lines read
+ * in bulk are added with a single copy.
+ */
+class LineBatch {
+private:
+    string _text;
+    vector<size_t> _ends;
+
+public:
+    void push_back(const char* data, const size_t length);
+    void push_back(const string& line);
+
+    /**
+     * Adds the complete lines (each ending with a newline) at the start
+     * of [text, last) with a single copy, stopping before the first line
+     * that is only a period when stop_at_period is set. Returns the end
+     * of the lines added: a partial line at the end is left out.
+     */
+    const char* push_lines(const char* text, const char* last, const bool stop_at_period);
+
+    size_t size() const;
+    bool empty() const;
+
+    /**
+     * The bytes of the line at the given index, valid until
+     * the next line is added.
+     */
+    const char* data(const size_t index) const;
+    size_t length(const size_t index) const;
+
+    /**
+     * Returns a copy of the line at the given index.
+     */
+    string line(const size_t index) const;
+
+    void clear();
+};
+
+#endif /* LineBatch_h */
@@ -1,68 +1,209 @@
 #include "LineEditor.h"
 #include <string>
-#include <fstream>
 #include <sstream>
 #include <iterator>
 #include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "Compression.h"
+#include "FileWriter.h"
+#include "JournaledBuffer.h"
+#include "OutputBuffer.h"
+#include "Pattern.h"
+#include "Parallel.h"
+#include "Script.h"
+#include "SharedBuffer.h"
+#include "Stats.h"
+#include "StringSearcher.h"
 
-void LineEditor::read_lines(istream & input_stream,
-                            list<string>& buffer,
-                            bool ignore_period) {
-    string line;
-    getline(input_stream, line);
-    while (input_stream.good() && (ignore_period || line != ".")) {
-        buffer.push_back(line);
-        getline(input_stream, line);
+LineEditor::File::File() : recovery(nullptr), current(0), is_written(true), journal(DEFAULT_UNDO_LIMIT) { }
+
+LineEditor::LineEditor(const string& filename, BufferType buffer_type, ostream& output, ostream& errors) :
+LineEditor(vector<string>(1, filename), buffer_type, output, errors) { }
+
+LineEditor::LineEditor(const vector<string>& filenames, BufferType buffer_type, ostream& output, ostream& errors) :
+_recovery(nullptr), _current(0), _is_written(true),
+_input(cin), _output(output), _errors(errors), _output_descriptor(&output == &cout ? STDOUT_FILENO : -1),
+_interactive(true), _running(true), _status(EXIT_SUCCESS),
+_parallel_threshold(DEFAULT_PARALLEL_THRESHOLD), _compression_level(Compression::DEFAULT_LEVEL), _journal(DEFAULT_UNDO_LIMIT), _files(filenames.size()), _active(0) {
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        activate(i);
+        open(filenames[i], buffer_type);
     }
+    activate(0);
 }
 
-LineEditor::LineEditor(const string& filename) :
-_current(0), _is_written(true), _filename(filename) {
-    ifstream input_file(_filename, ios::in);
-    
-    if (!input_file) {
-        cout << "Unable to open file " << _filename << endl;
-        cout << "\"" << _filename << "\" " << "[New File]" << endl;
+LineEditor::~LineEditor() {
+    if (_background_write) {
+        _background_write->writer.join();
+    }
+}
+
+void LineEditor::open(const string& filename, BufferType buffer_type) {
+    Buffer* buffer;
+    if (buffer_type == SHARED_BUFFER) {
+        if (!_store) {
+            _store = make_shared<LineStore>();
+        }
+        buffer = new SharedBuffer(_store);
+    } else {
+        buffer = Buffer::create(buffer_type);
+    }
+    _recovery = new JournaledBuffer(buffer, filename + ".journal");
+    _buffer.reset(_recovery);
+    _filename = filename;
+    _current = 0;
+    _is_written = true;
+    _watcher.reset(new FileWatcher());
+    if (!load()) {
+        _output << "Unable to open file " << _filename << endl;
+        _output << "\"" << _filename << "\" " << "[New File]" << endl;
         //_is_written = false; // prompt before exiting in case of writing a new file.
     } else {
-        read_lines(input_file, _buffer, true);
-        _current = _buffer.size() ? (_buffer.size() - 1) : 0;
-        cout << "\"" << _filename << "\" " << (_current + 1) << " line" << (_current ? "s" : "") << endl;
+        _current = _buffer->size() ? (_buffer->size() - 1) : 0;
+        print_loaded();
     }
-    input_file.close();
 }
 
-void LineEditor::quit() {
-    if (_is_written) {
-        // nothing to do.
-        exit(EXIT_SUCCESS);
-    } else {
-        bool understood(false);
-        while (!understood) {
-            string response;
-            cout << "Save changes to " << _filename << " (y/n)? ";
-            cin >> response;
-            if (!cin) {
-                cerr << "Something went wrong!";
-                exit(EXIT_FAILURE);
+bool LineEditor::load() {
+    // watched first, so that a change made while the file is read is seen.
+    _watcher->watch(_filename);
+    bool loaded;
+    {
+        Stats::Timer timer(Stats::LOAD);
+        loaded = _buffer->load(_filename);
+    }
+    if (loaded && _watcher->check() != FileWatcher::UNCHANGED) {
+        // how much of the change was read is not known: only loading it again is safe.
+        _watcher->forget();
+    }
+    return loaded;
+}
+
+void LineEditor::print_loaded() {
+    _output << "\"" << _filename << "\" " << (_current + 1) << " line" << (_current ? "s" : "") << endl;
+    size_t first;
+    const size_t invalid = _buffer->invalid_lines(first);
+    if (invalid) {
+        // only a warning: the bytes are kept (and written back) as they are.
+        _errors << "warning: " << invalid << " line" << (invalid == 1 ? " is" : "s are")
+                << " not valid UTF-8, the first is line " << (first + 1) << endl;
+    }
+}
+
+void LineEditor::swap_file(File& file) {
+    swap(_buffer, file.buffer);
+    swap(_recovery, file.recovery);
+    swap(_current, file.current);
+    swap(_is_written, file.is_written);
+    swap(_filename, file.filename);
+    swap(_journal, file.journal);
+    swap(_search_index, file.search_index);
+    swap(_watcher, file.watcher);
+}
+
+void LineEditor::activate(const size_t file) {
+    if (file == _active) {
+        return;
+    }
+    // the members go to their entry, taking its blank to the other one.
+    swap_file(_files[_active]);
+    swap_file(_files[file]);
+    _active = file;
+}
+
+void LineEditor::files(const Command& command) {
+    const size_t count = _files.size();
+    switch (command.getType()) {
+        case LIST_FILES:
+            for (size_t i = 0; i < count; ++i) {
+                const bool active = (i == _active);
+                const size_t size = active ? _buffer->size() : _files[i].buffer->size();
+                const bool written = active ? _is_written : _files[i].is_written;
+                _output << (i + 1) << (active ? " * " : "   ") << "\"" << (active ? _filename : _files[i].filename)
+                        << "\" " << size << " line" << (size == 1 ? "" : "s") << (written ? "" : " [modified]") << endl;
             }
-            if (response == "y" || response == "Y") {
-                write();
-                understood = true;
-            } else if (response == "n" || response == "N") {
-                understood = true;
-            } else {
-                cout << "Only 'y' and 'n' are valid responses." << endl;
+            return;
+        case SWITCH_FILE:
+            if (command.getLineNumber() > count) {
+                error() << "error: no file " << command.getLineNumber() << endl;
+                return;
+            }
+            activate(command.getLineNumber() - 1);
+            break;
+        case NEXT_FILE:
+            activate((_active + 1) % count);
+            break;
+        case PREVIOUS_FILE:
+        default:
+            activate((_active + count - 1) % count);
+            break;
+    }
+    const size_t size = _buffer->size();
+    _output << "\"" << _filename << "\" " << size << " line" << (size == 1 ? "" : "s") << endl;
+}
+
+bool LineEditor::close() {
+    if (!_is_written && !_interactive) {
+        // nobody to ask: the changes are lost.
+        error() << "warning: changes to " << _filename << " not written" << endl;
+    } else if (!_is_written) {
+        if (confirm("Save changes to " + _filename)) {
+            if (!write()) {
+                return false;
             }
+        } else if (!_running) {
+            return false;
+        }
+    }
+    // the changes were written or dropped on purpose.
+    _recovery->discard();
+    return true;
+}
+
+bool LineEditor::confirm(const string& question) {
+    if (!_interactive) {
+        return false;
+    }
+    while (true) {
+        string response;
+        _output << question << " (y/n)? ";
+        if (!_input.word(response)) {
+            fail("Something went wrong!");
+            return false;
+        }
+        // the rest of the line is part of the answer, not a command.
+        string rest;
+        _input.getline(rest);
+        if (response == "y" || response == "Y") {
+            return true;
+        } else if (response == "n" || response == "N") {
+            return false;
+        }
+        _output << "Only 'y' and 'n' are valid responses." << endl;
+    }
+}
+
+void LineEditor::quit() {
+    finish_write(true);
+    const size_t active = _active;
+    for (size_t i = 0; i < _files.size(); ++i) {
+        activate(i);
+        if (!close()) {
+            activate(active);
+            return;
         }
-        exit(EXIT_SUCCESS);
     }
+    activate(active);
+    _running = false;
 }
 
 void LineEditor::append(const size_t line_number) {
-    list<string> temp;
+    LineBatch temp;
     _current = line_number;
-    read_lines(cin, temp);
+    _input.read_lines(temp);
     // insert the temporary buffer into the current buffer at the position indicated by _current.
     if (temp.size() > 0)
       insert_buffer(temp);
@@ -70,58 +211,209 @@ void LineEditor::append(const size_t line_number) {
       _current = line_number - 1;
 }
 
-void LineEditor::insert_buffer(const list<string> &temp) {
+void LineEditor::insert_buffer(const LineBatch &temp) {
     if (temp.size() > 0) {
-        auto origIt = next(begin(_buffer), _current);
-        _buffer.insert(origIt, begin(temp), end(temp));
+        _buffer->insert(_current, temp);
+        _search_index.inserted(_current, temp);
+        _journal.record(_current, _buffer->copy(_current, _current), temp.size());
         _is_written = false;
         move_down(temp.size()-1, false);
     }
 }
 
-void LineEditor::write() {
-    ofstream file(_filename, ios::out);
-    if (!file) {
-        cerr << "Fatal error when writing to file" << endl;
-        exit(EXIT_FAILURE);
+bool LineEditor::write() {
+    // an earlier write must not land after this one.
+    finish_write(true);
+    if (!_running || !may_overwrite()) {
+        return false;
     }
-    for (auto it = begin(_buffer); it != end(_buffer); ++it) {
-        file << *it << endl;
+    if (!write_file(*_buffer, _filename, _compression_level)) {
+        fail("Fatal error when writing to file");
+        return false;
     }
-    file.close();
+    _watcher->watch(_filename);
     _is_written = true;
-    size_t size = _buffer.size();
-    cout << "\"" << _filename << "\" " << size << " line" << (size > 1 ? "s " : " ") << "written" << endl;
+    _recovery->restart();
+    print_written(_filename, _buffer->size());
+    return true;
+}
+
+bool LineEditor::may_overwrite() {
+    const FileWatcher::Change change = _watcher->check();
+    // a file removed meanwhile is simply written again.
+    if (change == FileWatcher::UNCHANGED || change == FileWatcher::REMOVED) {
+        return true;
+    }
+    if (!_interactive) {
+        error() << "error: " << _filename << " changed on disk since it was read, not written" << endl;
+        return false;
+    }
+    return confirm(_filename + " changed on disk since it was read, overwrite it");
+}
+
+void LineEditor::write_in_background() {
+    finish_write(true);
+    if (!_running) {
+        return;
+    }
+    unique_ptr<Buffer> snapshot = _buffer->snapshot();
+    if (!snapshot) {
+        write();
+        return;
+    }
+    if (!may_overwrite()) {
+        return;
+    }
+    _background_write.reset(new BackgroundWrite());
+    BackgroundWrite& pending = *_background_write;
+    pending.done = false;
+    pending.succeeded = false;
+    pending.filename = _filename;
+    pending.recovery = _recovery;
+    pending.file = _active;
+    pending.mark = _recovery->mark();
+    pending.lines = _buffer->size();
+    const int level = _compression_level;
+    Buffer* buffer = snapshot.release();
+    pending.writer = thread([&pending, buffer, level]() {
+        unique_ptr<Buffer> owned(buffer);
+        pending.succeeded = write_file(*owned, pending.filename, level);
+        if (pending.succeeded) {
+            // right away: the journal no longer applies to the file written,
+            // and a change made to it from now on must be seen.
+            pending.watcher.reset(new FileWatcher());
+            pending.watcher->watch(pending.filename);
+            pending.recovery->restart(pending.mark);
+        }
+        pending.done = true;
+    });
+}
+
+void LineEditor::finish_write(const bool wait) {
+    if (!_background_write || (!wait && !_background_write->done)) {
+        return;
+    }
+    _background_write->writer.join();
+    unique_ptr<BackgroundWrite> finished(move(_background_write));
+    if (!finished->succeeded) {
+        fail("Fatal error when writing to file");
+        return;
+    }
+    // changes made during the write are not in the file.
+    const bool written = (finished->recovery->mark() == finished->mark);
+    (finished->file == _active ? _is_written : _files[finished->file].is_written) = written;
+    (finished->file == _active ? _watcher : _files[finished->file].watcher) = move(finished->watcher);
+    print_written(finished->filename, finished->lines);
+}
+
+bool LineEditor::write_file(const Buffer& buffer, const string& filename, const int level) {
+    // The buffer may still be reading from the mapped file, so it can't be
+    // truncated: FileWriter writes a new file and moves it over the old one.
+    FileWriter file;
+    if (!file.open(filename, level)) {
+        return false;
+    }
+    buffer.write_to(file);
+    return file.commit();
+}
+
+void LineEditor::print_written(const string& filename, const size_t lines) {
+    _output << "\"" << filename << "\" " << lines << " line" << (lines > 1 ? "s " : " ") << "written" << endl;
 }
 
 void LineEditor::insert(const size_t line_number) {
-    list<string> temp;
+    LineBatch temp;
     _current = line_number-1;
-    read_lines(cin, temp);
+    _input.read_lines(temp);
     insert_buffer(temp);
 }
 
 void LineEditor::print_empty_buffer_error() {
-    cerr << "error: file empty - enter 'q' to quit, 'a' to append, or 'i' to insert." << endl;
+    error() << "error: file empty - enter 'q' to quit, 'a' to append, or 'i' to insert." << endl;
 }
 
 void LineEditor::remove(const size_t from, const size_t to) {
-    if (_buffer.size() == 0) {
+    if (_buffer->size() == 0) {
         print_empty_buffer_error();
         return;
     }
     // place the 'cursor' after the deleted lines if there are any, otherwise before.
-    if (to >= _buffer.size()) { // after the last line
+    if (to >= _buffer->size()) { // after the last line
         _current = from > 1 ? from-2 : 0; // place cursor in the line before (0 indexed)
     } else {
         _current = from-1;
     }
-    _buffer.erase(next(begin(_buffer), from-1), next(begin(_buffer), to));
+    _journal.record(from-1, _buffer->cut(from-1, to), 0);
+    _search_index.removed(from-1, to);
+    _is_written = false;
+}
+
+void LineEditor::copy_lines(const size_t from, const size_t to, const size_t after) {
+    if (_buffer->size() == 0) {
+        print_empty_buffer_error();
+        return;
+    }
+    if (after > _buffer->size()) {
+        error() << "error: invalid destination " << after << endl;
+        return;
+    }
+    const size_t count = to - from + 1;
+    _buffer->copy_lines(from-1, to, after);
+    _journal.record(after, _buffer->copy(after, after), count);
+    _search_index.inserted(after, count);
     _is_written = false;
+    _current = after + count - 1;
+}
+
+void LineEditor::move_lines(const size_t from, const size_t to, const size_t after) {
+    if (_buffer->size() == 0) {
+        print_empty_buffer_error();
+        return;
+    }
+    if (after > _buffer->size() || (after >= from && after < to)) {
+        error() << "error: invalid destination " << after << endl;
+        return;
+    }
+    const size_t count = to - from + 1;
+    const size_t moved_to = after > to ? after - count : after;
+    // right after the range or right before it, the lines stay put.
+    if (after != to && after != from - 1) {
+        _buffer->move_lines(from-1, to, after);
+        _journal.record_move(from-1, to, after);
+        _search_index.removed(from-1, to);
+        _search_index.inserted(moved_to, count);
+        _is_written = false;
+    }
+    _current = moved_to + count - 1;
+}
+
+void LineEditor::join(const size_t from, const size_t to) {
+    if (_buffer->size() == 0) {
+        print_empty_buffer_error();
+        return;
+    }
+    // a single line is joined with the next one.
+    const size_t last = (from == to) ? to + 1 : to;
+    if (last > _buffer->size()) {
+        error() << "error: invalid range " << from << " through " << last << endl;
+        return;
+    }
+    LineBatch joined;
+    string text;
+    _buffer->for_each(from-1, last, [&text](const char* data, size_t length) {
+        text.append(data, length);
+    });
+    joined.push_back(text);
+    _journal.record(from-1, _buffer->cut(from-1, last), 1);
+    _buffer->insert(from-1, joined);
+    _search_index.removed(from-1, last);
+    _search_index.inserted(from-1, joined);
+    _is_written = false;
+    _current = from-1;
 }
 
 void LineEditor::print_current_line_number() const {
-    cout << _current + 1 << endl;
+    _output << _current + 1 << endl;
 }
 
 void LineEditor::move_up(const size_t number_of_lines, bool print_bof) {
@@ -129,7 +421,7 @@ void LineEditor::move_up(const size_t number_of_lines, bool print_bof) {
      current -= number_of_lines;
     if (current < 0) {
         if (print_bof)
-            cout << "BOF reached" << endl;
+            _output << "BOF reached" << endl;
         _current = 0;
     } else {
         _current = current;
@@ -138,93 +430,586 @@ void LineEditor::move_up(const size_t number_of_lines, bool print_bof) {
 
 void LineEditor::move_down(const size_t number_of_lines, bool print_eof) {
     _current += number_of_lines;
-    if (_current >= _buffer.size()) {
+    if (_current >= _buffer->size()) {
         if (print_eof)
-            cout << "EOF reached" << endl;
-        _current = _buffer.size() ? (_buffer.size()-1) : 0;
+            _output << "EOF reached" << endl;
+        _current = _buffer->size() ? (_buffer->size()-1) : 0;
     }
 }
 
 void LineEditor::print(const size_t from, const size_t to, bool line_number) {
-    if (_buffer.size() == 0) {
+    if (_buffer->size() == 0) {
         print_empty_buffer_error();
         return;
     }
+    // the lines are not modified while printing: they don't need to be copied.
+    OutputBuffer output(_output, _output_descriptor);
     size_t current = from;
-    for (auto it = next(begin(_buffer), from-1); it != next(begin(_buffer), to); ++it) {
-        ostringstream oss;
-        oss << current << "\t";
-        cout << (line_number? oss.str() : "") << *it << endl;
+    _buffer->for_each(from-1, to, [&output, &current, line_number](const char* data, size_t length) {
+        if (line_number) {
+            output.append_number(current);
+            output.append('\t');
+        }
+        output.append_line(data, length);
         ++current;
-    }
+    });
+    output.flush();
+    _output.flush();
     _current = to - 1;
 }
 
 void LineEditor::change(const size_t from, const size_t to) {
-    if (_buffer.size() == 0) {
+    if (_buffer->size() == 0) {
         print_empty_buffer_error();
         return;
     }
     string from_what, to_what;
-    cout << "Change what? ";
-    getline(cin, from_what);
-    if (!cin.good()) {
-        cerr << "Something went wrong!";
-        exit(EXIT_FAILURE);
-    }
-    cout << "    to what? ";
-    getline(cin, to_what);
-    if (!cin.good()) {
-        cerr << "Something went wrong!";
-        exit(EXIT_FAILURE);
-    }
-    size_t current(from-1);
-    for (auto it = next(begin(_buffer), from-1); it != next(begin(_buffer), to); ++it) {
-        if (Command::replace_all(*it, from_what, to_what)) {
-            _current = current;
+    if (!read_change(from_what, to_what)) {
+        return;
+    }
+    const StringSearcher searcher(from_what);
+    if (to - from + 1 < _parallel_threshold) {
+        // lines without a match are only read, the others are
+        // replaced once the whole range has been searched.
+        vector<pair<size_t, string>> changes;
+        string output;
+        size_t current(from-1);
+        Stats::Timer timer(Stats::REPLACE_ALL);
+        _buffer->for_each(from-1, to, [&](const char* data, size_t length) {
+            if (searcher.replace_all(data, length, to_what, output)) {
+                changes.push_back(make_pair(current, output));
+            }
+            ++current;
+        });
+        store_changes(changes, 0);
+        return;
+    }
+
+    // Big range: each core works out the changes for its part of the
+    // range, then they are stored in order by this thread.
+    vector<pair<const char*, size_t>> lines;
+    lines.reserve(to - from + 1);
+    _buffer->for_each(from-1, to, [&lines](const char* data, size_t length) {
+        lines.push_back(make_pair(data, length));
+    });
+    vector<vector<pair<size_t, string>>> changes(max(1u, thread::hardware_concurrency()));
+    const size_t chunks = parallel_chunks(lines.size(), MIN_LINES_PER_THREAD,
+        [&](size_t chunk, size_t first, size_t last) {
+            Stats::Timer timer(Stats::REPLACE_ALL);
+            string output;
+            for (size_t i = first; i < last; ++i) {
+                if (searcher.replace_all(lines[i].first, lines[i].second, to_what, output)) {
+                    changes[chunk].push_back(make_pair(i, output));
+                }
+            }
+        });
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        store_changes(changes[chunk], from-1);
+    }
+}
+
+bool LineEditor::read_change(string& from_what, string& to_what) {
+    if (_interactive)
+        _output << "Change what? ";
+    _input.getline(from_what);
+    if (!_input.good()) {
+        fail("Something went wrong!");
+        return false;
+    }
+    if (_interactive)
+        _output << "    to what? ";
+    _input.getline(to_what);
+    if (!_input.good()) {
+        fail("Something went wrong!");
+        return false;
+    }
+    Stats::add(Stats::INPUT_READ, from_what.size() + to_what.size() + 2);
+    return true;
+}
+
+void LineEditor::global(const size_t from, const size_t to, const Command& command) {
+    if (_buffer->size() == 0) {
+        print_empty_buffer_error();
+        return;
+    }
+    // an empty pattern is the last one used, compiled only when it changes.
+    const string& source = command.getPattern();
+    if (source.empty()) {
+        if (_pattern.empty()) {
+            error() << "error: no previous pattern" << endl;
+            return;
         }
-        ++current;
+    } else if (source != _pattern.source()) {
+        string message;
+        if (!_pattern.compile(source, max(1u, thread::hardware_concurrency()), message)) {
+            error() << "error: invalid pattern: " << message << endl;
+            return;
+        }
+    }
+    const CommandType type = command.getGlobalType();
+    string from_what, to_what;
+    if (type == CHANGE && !read_change(from_what, to_what)) {
+        return;
+    }
+    const StringSearcher searcher(from_what);
+    const bool inverted = command.isInverted();
+
+    // One pass, on all cores for big ranges, finds the lines the command
+    // applies to (and their new content for 'c'), then the command runs
+    // on all of them at once.
+    vector<pair<const char*, size_t>> lines;
+    lines.reserve(to - from + 1);
+    _buffer->for_each(from-1, to, [&lines](const char* data, size_t length) {
+        lines.push_back(make_pair(data, length));
+    });
+    const size_t chunk_count = max(1u, thread::hardware_concurrency());
+    vector<vector<size_t>> selected(chunk_count);
+    vector<vector<pair<size_t, string>>> changes(chunk_count);
+    const size_t min_chunk = (lines.size() < _parallel_threshold) ? lines.size() : MIN_LINES_PER_THREAD;
+    const size_t chunks = parallel_chunks(lines.size(), min_chunk,
+        [&](size_t chunk, size_t first, size_t last) {
+            string output;
+            for (size_t i = first; i < last; ++i) {
+                if (_pattern.matches(lines[i].first, lines[i].second, chunk) == inverted) {
+                    continue;
+                }
+                if (type != CHANGE) {
+                    selected[chunk].push_back(i);
+                } else if (searcher.replace_all(lines[i].first, lines[i].second, to_what, output)) {
+                    changes[chunk].push_back(make_pair(i, output));
+                }
+            }
+        });
+
+    if (type == CHANGE) {
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            store_changes(changes[chunk], from-1);
+        }
+    } else if (type == REMOVE) {
+        // runs of consecutive lines are removed from the last one,
+        // so the indices of the ones before don't move.
+        size_t removed(0), after(0);
+        for (size_t chunk = chunks; chunk-- > 0; ) {
+            const vector<size_t>& indices = selected[chunk];
+            for (size_t last = indices.size(); last > 0; ) {
+                size_t first = last - 1;
+                while (first > 0 && indices[first-1] + 1 == indices[first]) {
+                    --first;
+                }
+                const size_t index = from-1 + indices[first];
+                const size_t count = last - first;
+                if (removed == 0) {
+                    after = index + count;
+                }
+                _journal.record(index, _buffer->cut(index, index + count), 0);
+                _search_index.removed(index, index + count);
+                removed += count;
+                last = first;
+            }
+        }
+        if (removed > 0) {
+            // like 'r': the line after the last one removed, or the last line.
+            after -= removed;
+            _current = (after < _buffer->size()) ? after : (_buffer->size() ? _buffer->size() - 1 : 0);
+            _is_written = false;
+        }
+    } else {
+        OutputBuffer output(_output, _output_descriptor);
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            for (auto it = begin(selected[chunk]); it != end(selected[chunk]); ++it) {
+                if (type == PRINT_WITH_LINE_NUM) {
+                    output.append_number(from + *it);
+                    output.append('\t');
+                }
+                output.append_line(lines[*it].first, lines[*it].second);
+                _current = from-1 + *it;
+            }
+        }
+        output.flush();
+        _output.flush();
+    }
+}
+
+void LineEditor::search(const Command& command) {
+    if (_buffer->size() == 0) {
+        print_empty_buffer_error();
+        return;
+    }
+    if (!command.getPattern().empty()) {
+        _search = command.getPattern();
+    } else if (_search.empty()) {
+        error() << "error: no previous search" << endl;
+        return;
+    }
+    // the search starts next to the current line and ends on it.
+    const bool forward = command.getType() == SEARCH_FORWARD;
+    const size_t size = _buffer->size();
+    const size_t start = forward ? (_current + 1) % size : (_current + size - 1) % size;
+    size_t found;
+    if (!_search_index.find(*_buffer, _search, start, forward, found)) {
+        error() << "error: no match" << endl;
+        return;
+    }
+    print(found + 1, found + 1);
+}
+
+void LineEditor::store_changes(const vector<pair<size_t, string>>& changes, const size_t first) {
+    for (size_t i = 0; i < changes.size(); ) {
+        size_t last = i + 1;
+        while (last < changes.size() && changes[last].first == changes[last-1].first + 1) {
+            ++last;
+        }
+        const size_t index = first + changes[i].first;
+        const size_t count = last - i;
+        // the journal only keeps the old lines of this run.
+        unique_ptr<Buffer::Lines> old_lines = _buffer->copy(index, index + count);
+        for (; i < last; ++i) {
+            _buffer->replace(first + changes[i].first, changes[i].second);
+            _search_index.changed(first + changes[i].first, changes[i].second.data(), changes[i].second.size());
+        }
+        _journal.record(index, move(old_lines), count);
+        _current = index + count - 1;
+        _is_written = false;
+    }
+}
+
+void LineEditor::undo() {
+    if (!_journal.undo(*_buffer, _current)) {
+        error() << "error: nothing to undo" << endl;
+        return;
+    }
+    _is_written = false;
+    // the lines swapped aren't known here.
+    _search_index.reset();
+}
+
+void LineEditor::redo() {
+    if (!_journal.redo(*_buffer, _current)) {
+        error() << "error: nothing to redo" << endl;
+        return;
+    }
+    _is_written = false;
+    // the lines swapped aren't known here.
+    _search_index.reset();
+}
+
+void LineEditor::reload() {
+    // a write still running would replace the file being read.
+    finish_write(true);
+    if (!_running) {
+        return;
+    }
+    FileWatcher::Change change = _watcher->check();
+    if (change == FileWatcher::GROWN && !appendable()) {
+        change = FileWatcher::REPLACED;
+    }
+    switch (change) {
+        case FileWatcher::UNCHANGED:
+            _output << "\"" << _filename << "\" unchanged" << endl;
+            return;
+        case FileWatcher::REMOVED:
+            error() << "error: " << _filename << " no longer exists" << endl;
+            return;
+        case FileWatcher::GROWN:
+            add_appended_lines();
+            return;
+        case FileWatcher::REPLACED:
+            break;
+    }
+    if (!_is_written && !_interactive) {
+        error() << "error: changes to " << _filename << " not written, not loaded again" << endl;
+        return;
+    }
+    if (!_is_written && !confirm("Discard changes to " + _filename + " and load it again")) {
+        return;
+    }
+    load_again();
+}
+
+void LineEditor::load_again() {
+    if (!load()) {
+        error() << "error: unable to open file " << _filename << endl;
+        return;
     }
+    // the journals are about the lines replaced.
+    _recovery->discard();
+    _journal.clear();
+    _search_index.reset();
+    _is_written = true;
+    _current = _buffer->size() ? (_buffer->size() - 1) : 0;
+    print_loaded();
+}
+
+bool LineEditor::appendable() const {
+    // the bytes appended to a compressed file can't be read on their own,
+    // and the last line of a modified buffer may not be the file's.
+    return _is_written && Compression::format(_filename) == Compression::NONE;
+}
 
+void LineEditor::add_appended_lines() {
+    const bool partial = !_watcher->ends_with_newline();
+    string bytes;
+    if (!_watcher->read_appended(bytes)) {
+        error() << "error: unable to read " << _filename << endl;
+        return;
+    }
+    // its own command to undo, like any change to the buffer.
+    _journal.start(_current);
+    const char* position = bytes.data();
+    const char* const last = position + bytes.size();
+    const bool joined = partial && _buffer->size() > 0;
+    const size_t last_index = _buffer->size();
+    if (joined) {
+        // the rest of the last line, up to the first newline.
+        const char* newline = static_cast<const char*>(memchr(position, '\n', last - position));
+        const char* end_of_line = newline ? newline : last;
+        const size_t index = _buffer->size() - 1;
+        const string line = _buffer->line(index) + string(position, end_of_line - position);
+        unique_ptr<Buffer::Lines> old_line = _buffer->copy(index, index + 1);
+        _buffer->replace(index, line);
+        _journal.record(index, move(old_line), 1);
+        _search_index.changed(index, line.data(), line.size());
+        position = newline ? newline + 1 : last;
+    }
+    LineBatch lines;
+    const char* end_of_lines = lines.push_lines(position, last, false);
+    if (end_of_lines < last) {
+        // the file doesn't end with a newline (yet).
+        lines.push_back(end_of_lines, last - end_of_lines);
+    }
+    if (!lines.empty()) {
+        const size_t index = _buffer->size();
+        _journal.record(index, _buffer->copy(index, index), lines.size());
+        _buffer->insert(index, lines);
+        _search_index.inserted(index, lines);
+    }
+    _journal.finish(_current);
+    // the buffer is the file again: the journal starts from it.
+    _recovery->restart();
+    _output << "\"" << _filename << "\" " << lines.size() << " line" << (lines.size() == 1 ? " " : "s ") << "added";
+    if (joined) {
+        _output << ", line " << last_index << " completed";
+    }
+    _output << endl;
 }
 
-void LineEditor::run() {
-    cout << "Entering command mode." << endl;
-    while(true) {
+void LineEditor::notice_change() {
+    // a file written in the background is replaced on purpose.
+    if (_background_write && _background_write->file == _active) {
+        return;
+    }
+    const FileWatcher::Change change = _watcher->check();
+    // the journal's edits still apply to the lines the file had, unless
+    // the last one got longer.
+    const bool followed = change == FileWatcher::GROWN && _watcher->ends_with_newline();
+    if (followed) {
+        _recovery->follow_append();
+    }
+    if (!_watcher->report(change)) {
+        return;
+    }
+    switch (change) {
+        case FileWatcher::GROWN:
+            _output << "\"" << _filename << "\" was appended to on disk, 'e' "
+                    << (appendable() ? "adds the new lines" : "loads it again") << endl;
+            break;
+        case FileWatcher::REPLACED:
+            // the lines not edited may still be read from the old file,
+            // which may have been cut short.
+            if (_is_written) {
+                _output << "\"" << _filename << "\" changed on disk, loading it again" << endl;
+                load_again();
+                return;
+            }
+            _output << "\"" << _filename << "\" changed on disk" << endl;
+            if (confirm("Discard changes to " + _filename + " and load it again")) {
+                load_again();
+                return;
+            }
+            _output << "'e' loads it again" << endl;
+            break;
+        case FileWatcher::REMOVED:
+            _output << "\"" << _filename << "\" was removed from disk" << endl;
+            break;
+        case FileWatcher::UNCHANGED:
+            break;
+    }
+    if (change != FileWatcher::UNCHANGED && !followed && !_is_written) {
+        _errors << "warning: the changes to " << _filename
+                << " can no longer be recovered after a crash, 'w' keeps them" << endl;
+    }
+}
+
+void LineEditor::offer_recovery() {
+    if (!_recovery->recoverable()) {
+        return;
+    }
+    while (true) {
+        string response;
+        _output << "Recover unsaved changes to " << _filename << " (y/n)? ";
+        if (!_input.getline(response)) {
+            fail("Something went wrong!");
+            return;
+        }
+        if (response == "y" || response == "Y") {
+            _search_index.reset();
+            if (_recovery->recover(_current)) {
+                _is_written = false;
+                size_t size = _buffer->size();
+                _output << "\"" << _filename << "\" " << size << " line" << (size > 1 ? "s " : " ") << "recovered" << endl;
+            } else {
+                error() << "error: unable to read the journal of " << _filename << endl;
+            }
+            return;
+        } else if (response == "n" || response == "N") {
+            _recovery->discard();
+            return;
+        }
+        _output << "Only 'y' and 'n' are valid responses." << endl;
+    }
+}
+
+int LineEditor::run() {
+    for (size_t i = 0; _running && i < _files.size(); ++i) {
+        activate(i);
+        offer_recovery();
+    }
+    activate(0);
+    if (!_running) {
+        return _status;
+    }
+    _output << "Entering command mode." << endl;
+    while(_running) {
         string input;
-        const size_t last_line = _buffer.size() == 0 ? 1 : _buffer.size();
-        Command cmd(_current+1, last_line);
-        cout << ":";
+        finish_write(false);
+        if (!_running) {
+            break;
+        }
+        notice_change();
+        if (!_running) {
+            break;
+        }
+        Command cmd(_current+1, last_line());
+        _output << ":";
         //cin >> input;
-        getline(cin, input);
-        if (!cin.good()) {
-            cerr << "Something went wrong!." << endl;
-            exit(EXIT_FAILURE);
+        _input.getline(input);
+        if (!_input.good()) {
+            fail("Something went wrong!.");
+            break;
         }
         if (!cmd.parse(input)) {
-            cerr << "error: invalid command" << endl;
+            error() << "error: invalid command" << endl;
         } else {
             executeCommand(cmd);
         }
     }
+    return _status;
+}
+
+int LineEditor::runScript(const Script& script) {
+    _interactive = false;
+    if (_recovery->recoverable()) {
+        // leave the journal alone: the changes can still be recovered.
+        fail("error: " + _filename + " has unsaved changes from a session that did not end, open it to recover them");
+        return _status;
+    }
+    const vector<Script::Step>& steps = script.steps();
+    for (auto it = begin(steps); _running && it != end(steps); ++it) {
+        // each command only gets to read its own input lines.
+        istringstream input(it->input);
+        setInput(input);
+        Command cmd(it->command);
+        cmd.rebind(_current+1, last_line());
+        executeCommand(cmd);
+    }
+    setInput(cin);
+    if (_running) { // the script didn't quit.
+        quit();
+    }
+    return _status;
+}
+
+void LineEditor::setParallelThreshold(const size_t lines) {
+    _parallel_threshold = lines;
+}
+
+void LineEditor::setUndoLimit(const size_t bytes) {
+    _journal.setLimit(bytes);
+    for (auto it = begin(_files); it != end(_files); ++it) {
+        it->journal.setLimit(bytes);
+    }
+}
+
+void LineEditor::setCompressionLevel(const int level) {
+    _compression_level = level;
+}
+
+void LineEditor::setInput(istream& input) {
+    _input.reset(input);
+}
+
+size_t LineEditor::last_line() const {
+    return _buffer->size() == 0 ? 1 : _buffer->size();
+}
+
+ostream& LineEditor::error() {
+    if (!_interactive) {
+        _status = EXIT_FAILURE;
+    }
+    return _errors;
+}
+
+void LineEditor::fail(const string& message) {
+    error() << message << endl;
+    _status = EXIT_FAILURE;
+    _running = false;
 }
 
 void LineEditor::executeCommand(const Command & command) {
+    if (_buffer->truncated()) {
+        // the command still runs: the lines lost read as zeros.
+        error() << "error: " << _filename << " was truncated on disk, the lines past its new end are lost" << endl;
+    }
     // command's current line is indexed starting at 0 while _current here is 0 based index.
     // The following line is useful for debugging
-    // cout << "Current line: " << _current << " and command's: " << command.getCurrentLine() << endl;
+    // _output << "Current line: " << _current << " and command's: " << command.getCurrentLine() << endl;
     if (command.getRangeStart() > command.getRangeEnd()
-        || (_buffer.size() > 0 && (command.getRangeEnd() > _buffer.size()))
+        || (_buffer->size() > 0 && (command.getRangeEnd() > _buffer->size()))
         || command.getRangeStart() < 1
-        || (_buffer.size() == 0 && (command.getRangeStart() > 1 || command.getRangeEnd() > 1))
+        || (_buffer->size() == 0 && (command.getRangeStart() > 1 || command.getRangeEnd() > 1))
         || command.getNumberOfLines() < 1
         )
     {
-        cerr << "error: invalid range " << command.getRangeStart() << " through " << command.getRangeEnd() << endl;
+        error() << "error: invalid range " << command.getRangeStart() << " through " << command.getRangeEnd() << endl;
         return;
     }
     
-    switch (command.getType()) {
+    const CommandType type = command.getType();
+    Stats::Timer timer(type);
+    if (type == UNDO || type == REDO) {
+        if (type == UNDO) {
+            undo();
+        } else {
+            redo();
+        }
+        _recovery->commit(_current);
+        return;
+    }
+    if (type == RELOAD) {
+        // the lines read from the file are not a command to undo.
+        reload();
+        _recovery->commit(_current);
+        return;
+    }
+    if (type == LIST_FILES || type == SWITCH_FILE || type == NEXT_FILE || type == PREVIOUS_FILE) {
+        // changes no file: nothing to record in either journal.
+        files(command);
+        return;
+    }
+
+    // everything the command changes is recorded as one group.
+    _journal.start(_current);
+    switch (type) {
         case PRINT:
             print(command.getRangeStart(), command.getRangeEnd());
             break;
@@ -232,7 +1017,12 @@ void LineEditor::executeCommand(const Command & command) {
             quit();
             break;
         case WRITE:
-            write();
+            // the prompt comes back while the file is written.
+            if (_interactive) {
+                write_in_background();
+            } else {
+                write();
+            }
             break;
         case INSERT:
             //insert(command.getLineNumber());
@@ -260,11 +1050,32 @@ void LineEditor::executeCommand(const Command & command) {
         case CHANGE:
             change(command.getRangeStart(), command.getRangeEnd());
             break;
+        case GLOBAL:
+            global(command.getRangeStart(), command.getRangeEnd(), command);
+            break;
+        case SEARCH_FORWARD:
+        case SEARCH_BACKWARD:
+            search(command);
+            break;
+        case COPY:
+            copy_lines(command.getRangeStart(), command.getRangeEnd(), command.getDestination());
+            break;
+        case MOVE:
+            move_lines(command.getRangeStart(), command.getRangeEnd(), command.getDestination());
+            break;
+        case JOIN:
+            join(command.getRangeStart(), command.getRangeEnd());
+            break;
+        case STATS:
+            Stats::report(_output);
+            break;
         case INVALID:
         default:
-            cerr << "An invalid command was issued." << endl;
+            error() << "An invalid command was issued." << endl;
             break;
     }
+    _journal.finish(_current);
+    _recovery->commit(_current);
 }
 
 
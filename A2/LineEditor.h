@@ -1,20 +1,62 @@
 #ifndef LineEditor_h
 #define LineEditor_h
 
+#include <atomic>
 #include <iostream>
-#include <list>
+#include <memory>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Buffer.h"
 #include "Command.h"
+#include "FileWatcher.h"
+#include "InputReader.h"
+#include "Pattern.h"
+#include "SearchIndex.h"
+#include "UndoJournal.h"
 
 using namespace std;
 
+class JournaledBuffer;
+class LineStore;
+class Script;
+
 /**
  * Class representing the line editor.
  */
 class LineEditor {
-    
+
+public:
+    /**
+     * Default number of lines from which the change command
+     * runs on all cores.
+     */
+    static const size_t DEFAULT_PARALLEL_THRESHOLD = 100000;
+
+    /**
+     * Default memory (in bytes) kept for undoing commands.
+     */
+    static const size_t DEFAULT_UNDO_LIMIT = 64 << 20;
+
 private:
-    list<string> _buffer;
+    /**
+     * Each thread of a parallel change gets at least that many lines.
+     */
+    static const size_t MIN_LINES_PER_THREAD = 10000;
+
+    /**
+     * The lines of all the files, when they share them (SHARED_BUFFER).
+     */
+    shared_ptr<LineStore> _store;
+
+    unique_ptr<Buffer> _buffer;
+
+    /**
+     * The buffer again, as the journal of unwritten changes.
+     */
+    JournaledBuffer* _recovery;
+
     /**
      * The current line (zero-based indexed)
      */
@@ -28,26 +70,179 @@ private:
     /**
      * Stores the filename
      */
-    const string _filename;
-    
+    string _filename;
+
     /**
-     * Helper function to read from an input stream and add
-     * lines to a buffer (could be a temporary one).
-     * Note, _current needs to be tracked outside this function.
-     * Use with ignorePeriod to true for reading files.
+     * Where the text for the append, insert and change commands
+     * (and answers to questions) is read from.
      */
-    static void read_lines(istream&, list<string>& buffer, bool ignore_period=false);
+    InputReader _input;
+
+    /**
+     * Where the regular output and the error messages go.
+     */
+    ostream& _output;
+    ostream& _errors;
+
+    /**
+     * The file descriptor _output writes to, if it is the standard
+     * output, so printed lines can be written without copying them.
+     */
+    const int _output_descriptor;
+
+    /**
+     * False when running a script: no prompts or questions.
+     */
+    bool _interactive;
+
+    /**
+     * Set to false when the editor should stop, with the exit status in _status.
+     */
+    bool _running;
+    int _status;
+
+    /**
+     * Ranges with at least that many lines are changed in parallel.
+     */
+    size_t _parallel_threshold;
+
+    /**
+     * Level at which compressed files are written.
+     */
+    int _compression_level;
+
+    /**
+     * What the commands changed, for undo and redo.
+     */
+    UndoJournal _journal;
+
+    /**
+     * The last pattern of a global command, kept compiled.
+     */
+    Pattern _pattern;
+
+    /**
+     * Index for the searches, and the last text searched.
+     */
+    SearchIndex _search_index;
+    string _search;
+
+    /**
+     * Tells when the file changes on disk, and what was appended to it.
+     */
+    unique_ptr<FileWatcher> _watcher;
+
+    /**
+     * What is kept for each open file: the members above
+     * from _buffer to _watcher, except _search.
+     */
+    struct File {
+        unique_ptr<Buffer> buffer;
+        JournaledBuffer* recovery;
+        size_t current;
+        bool is_written;
+        string filename;
+        UndoJournal journal;
+        SearchIndex search_index;
+        unique_ptr<FileWatcher> watcher;
+
+        File();
+    };
+
+    /**
+     * The open files, in the order they were given. The file being edited
+     * is the one at _active, whose state is in the members: its entry only
+     * holds a blank File. Switching files swaps the members with the
+     * entries, which costs the same whatever the size of the files.
+     */
+    vector<File> _files;
+    size_t _active;
+
+    /**
+     * A 'w' running in the background: its thread writes a snapshot of
+     * the buffer while commands go on, then restarts the journal of the
+     * file from it and watches the file written; it touches nothing
+     * else but the fields up to recovery, and watcher. The command loop
+     * reports it once done.
+     */
+    struct BackgroundWrite {
+        thread writer;
+        atomic<bool> done;
+        bool succeeded;
+        string filename;
+        JournaledBuffer* recovery;
+
+        /**
+         * The file written (an index in _files), its journal mark and its
+         * number of lines when the snapshot was taken.
+         */
+        size_t file;
+        size_t mark;
+        size_t lines;
+
+        /**
+         * Watches the file from right after it was written, for its entry.
+         */
+        unique_ptr<FileWatcher> watcher;
+    };
+    unique_ptr<BackgroundWrite> _background_write;
+
+    /**
+     * Opens the file in the members, replacing what was there.
+     */
+    void open(const string& filename, BufferType buffer_type);
+
+    /**
+     * Loads the file in the buffer and starts watching it. The buffer is
+     * left as it was if the file could not be read.
+     */
+    bool load();
+
+    /**
+     * Prints the number of lines loaded, and the lines that are not valid UTF-8.
+     */
+    void print_loaded();
+
+    /**
+     * Swaps the state of the file being edited with the given one.
+     */
+    void swap_file(File& file);
+
+    /**
+     * Makes the file at the given index the one being edited.
+     */
+    void activate(const size_t file);
+
+    /**
+     * Lists the open files, or switches to another one.
+     */
+    void files(const Command& command);
+
+    /**
+     * Asks whether to write the file if it has changes, then drops its
+     * journal. Returns false if the answer could not be read or the
+     * file was not written.
+     */
+    bool close();
+
+    /**
+     * Asks the question until the answer is 'y' or 'n' (the rest of its
+     * line is dropped). Returns true for
+     * 'y'; false for 'n', when running a script (there is nobody to ask)
+     * or if the answer could not be read (the editor then stops).
+     */
+    bool confirm(const string& question);
     
     /**
      * Helper function to insert a temporary buffer into the main
      * buffer at the index specified by _current.
      * It also updates _current.
      */
-    void insert_buffer(const list<string>& temp);
+    void insert_buffer(const LineBatch& temp);
     
     /**
-     * Exits the editor. Prompts the user to save file if it
-     * has not yet been written.
+     * Exits the editor. Prompts the user to save each file
+     * that has not yet been written.
      */
     void quit();
     
@@ -57,9 +252,35 @@ private:
     void append(const size_t line_number);
     
     /**
-     * Saves the buffer to file, line by line.
+     * Saves the buffer to file, line by line. Returns false if it was
+     * not written.
+     */
+    bool write();
+
+    /**
+     * Whether the file can be written: asks first if it changed on disk
+     * since it was read, and refuses when running a script.
+     */
+    bool may_overwrite();
+
+    /**
+     * Starts writing a snapshot of the buffer in the background, or writes
+     * it right away if the buffer engine can't take one.
+     */
+    void write_in_background();
+
+    /**
+     * Reports the background write if it is done, or once it is when
+     * wait is set. The file is written only if it didn't change since.
+     */
+    void finish_write(const bool wait);
+
+    /**
+     * Writes the buffer to the file. Returns false if it failed.
      */
-    void write();
+    static bool write_file(const Buffer& buffer, const string& filename, const int level);
+
+    void print_written(const string& filename, const size_t lines);
     
     /**
      * Inserts a the input text before the given line number.
@@ -70,6 +291,27 @@ private:
      * Removes the lines from the given range. Edges are inclusive. Line number must be valid.
      */
     void remove(const size_t from, const size_t to);
+
+    /**
+     * Copies the lines of the range after the given line (0 for the top).
+     * Only what refers to their text is copied, the text is shared.
+     * The current line is moved to the last line copied.
+     */
+    void copy_lines(const size_t from, const size_t to, const size_t after);
+
+    /**
+     * Moves the lines of the range after the given line (0 for the top),
+     * which must not be within the range. The lines are relinked,
+     * their text stays in place. The current line is moved to the last
+     * line moved.
+     */
+    void move_lines(const size_t from, const size_t to, const size_t after);
+
+    /**
+     * Joins the lines of the range into one, or the line with the next
+     * one for a single line. The current line is moved to the result.
+     */
+    void join(const size_t from, const size_t to);
     
     /**
      * Displays current line number.
@@ -103,17 +345,161 @@ private:
      * another given input between the given [range]
      */
     void change(const size_t from, const size_t to);
+
+    /**
+     * Reads the text to replace and its replacement for the change commands.
+     * Returns false if the input failed (the editor then stops).
+     */
+    bool read_change(string& from_what, string& to_what);
+
+    /**
+     * Runs the command's print, print with numbers, remove or change
+     * on the lines of the given range that match its pattern
+     * (or that don't, for v).
+     */
+    void global(const size_t from, const size_t to, const Command& command);
+
+    /**
+     * Moves to the next (or previous) line containing the command's text,
+     * wrapping around at the end (or beginning), and prints it.
+     */
+    void search(const Command& command);
+
+    /**
+     * Stores the changed lines found by change, given as (index, new line)
+     * pairs in increasing order, with the indices relative to first.
+     * Each run of consecutive lines is recorded as one edit in the journal.
+     */
+    void store_changes(const vector<pair<size_t, string>>& changes, const size_t first);
+
+    /**
+     * Reads the file again if it changed on disk: only the new lines when
+     * it was appended to and the buffer has no changes, or all of it
+     * (asking first if the buffer has changes, which are then lost).
+     */
+    void reload();
+
+    /**
+     * Loads the file again in place of the buffer, whose undo and crash
+     * journals are then dropped. Tells if it could not be read.
+     */
+    void load_again();
+
+    /**
+     * Whether the lines appended to the file can be added on their own:
+     * only to a buffer holding what the file had, and not compressed.
+     */
+    bool appendable() const;
+
+    /**
+     * Adds the lines appended to the file since it was read at the end of
+     * the buffer, the first one completing the last line if the file did
+     * not end with a newline. It is undone like a command.
+     */
+    void add_appended_lines();
+
+    /**
+     * Tells, once, that the file changed on disk. The crash journal
+     * follows the file when it was only appended to; otherwise unwritten
+     * changes can no longer be recovered, which is told too. A file
+     * replaced or rewritten is loaded again before the next command, as
+     * the buffer may still read lines from it, asking first if the
+     * buffer has changes.
+     */
+    void notice_change();
+
+    /**
+     * Reverts the last command that changed the buffer.
+     */
+    void undo();
+
+    /**
+     * Applies the last command undone again.
+     */
+    void redo();
     
     void print_empty_buffer_error();
 
+    /**
+     * If the last session on the file ended without writing or
+     * discarding its changes, asks whether to bring them back.
+     */
+    void offer_recovery();
+
+    /**
+     * The last line number as seen by the commands.
+     */
+    size_t last_line() const;
+
+    /**
+     * Stream for error messages. When running a script, an error
+     * also makes the final exit status a failure.
+     */
+    ostream& error();
+
+    /**
+     * Prints the error message and stops the editor with a failure status.
+     */
+    void fail(const string& message);
+
 
 public:
-    LineEditor(const string& filename);
+    /**
+     * Opens the given file using the given buffer engine.
+     * Messages are written to the given output and error streams.
+     */
+    LineEditor(const string& filename, BufferType buffer_type=PIECE_TABLE_BUFFER,
+               ostream& output=cout, ostream& errors=cerr);
+
+    /**
+     * Opens all the given files, each with a buffer of the given type,
+     * and starts on the first one. With SHARED_BUFFER, the files share
+     * one LineStore.
+     */
+    LineEditor(const vector<string>& filenames, BufferType buffer_type=PIECE_TABLE_BUFFER,
+               ostream& output=cout, ostream& errors=cerr);
+
+    /**
+     * Waits for a write still running in the background.
+     */
+    ~LineEditor();
     
     /**
      * Call this to start the program.
+     * Returns the exit status once the user quits.
+     */
+    int run();
+
+    /**
+     * Runs all the commands of the script without prompting,
+     * then quits (discarding unwritten changes).
+     * Returns the exit status: failure if any command failed.
+     */
+    int runScript(const Script& script);
+
+    /**
+     * Sets the number of lines from which the change command
+     * splits its range across all cores.
+     */
+    void setParallelThreshold(const size_t lines);
+
+    /**
+     * Sets the memory (in bytes) kept for undoing commands. The oldest
+     * commands can no longer be undone once it is used up.
+     */
+    void setUndoLimit(const size_t bytes);
+
+    /**
+     * Sets the level at which .gz and .zst files are written:
+     * 0 to 9 for gzip, 1 to 19 for zstd.
+     */
+    void setCompressionLevel(const int level);
+
+    /**
+     * Sets where the text for the append, insert and change commands
+     * (and answers to questions) is read from. Standard input by default.
      */
-    void run();
+    void setInput(istream& input);
     
     /**
      * The parser will generate a Command object
@@ -0,0 +1,109 @@
+#include "LineStore.h"
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+const size_t LineStore::MIN_SLOTS;
+
+LineStore::LineStore() : _slots(MIN_SLOTS, nullptr), _count(0), _bytes(0) { }
+
+LineStore::~LineStore() {
+    for (auto it = begin(_slots); it != end(_slots); ++it) {
+        if (*it != nullptr) {
+            ::operator delete(*it);
+        }
+    }
+}
+
+size_t LineStore::hash(const char* data, const size_t length) {
+    // 8 bytes at a time, multiplied and folded.
+    uint64_t hash = length * 0x9E3779B97F4A7C15ULL;
+    size_t i(0);
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    uint64_t word(0);
+    memcpy(&word, data + i, length - i);
+    hash = (hash ^ word) * 0xC4CEB9FE1A85EC53ULL;
+    return static_cast<size_t>(hash ^ (hash >> 29));
+}
+
+void LineStore::grow() {
+    vector<Line*> slots(_slots.size() * 2, nullptr);
+    const size_t mask = slots.size() - 1;
+    for (auto it = begin(_slots); it != end(_slots); ++it) {
+        if (*it != nullptr) {
+            size_t slot = (*it)->_hash & mask;
+            while (slots[slot] != nullptr) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = *it;
+        }
+    }
+    _slots.swap(slots);
+}
+
+LineStore::Line* LineStore::add(const char* data, const size_t length) {
+    const size_t line_hash = hash(data, length);
+    const size_t mask = _slots.size() - 1;
+    size_t slot = line_hash & mask;
+    for (; _slots[slot] != nullptr; slot = (slot + 1) & mask) {
+        Line* line = _slots[slot];
+        if (line->_hash == line_hash && line->_length == length && memcmp(line->data(), data, length) == 0) {
+            ++line->_references;
+            return line;
+        }
+    }
+    Line* line = new (::operator new(sizeof(Line) + length)) Line();
+    line->_hash = line_hash;
+    line->_length = length;
+    line->_references = 1;
+    memcpy(line + 1, data, length);
+    _slots[slot] = line;
+    ++_count;
+    _bytes += length;
+    if (_count * 2 > _slots.size()) {
+        grow();
+    }
+    return line;
+}
+
+void LineStore::release(Line* line) {
+    if (--line->_references > 0) {
+        return;
+    }
+    const size_t mask = _slots.size() - 1;
+    size_t slot = line->_hash & mask;
+    while (_slots[slot] != line) {
+        slot = (slot + 1) & mask;
+    }
+    // the lines after it that would no longer be found are moved back.
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (_slots[next] == nullptr) {
+            break;
+        }
+        const size_t home = _slots[next]->_hash & mask;
+        const bool stays = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (!stays) {
+            _slots[slot] = _slots[next];
+            slot = next;
+        }
+    }
+    _slots[slot] = nullptr;
+    --_count;
+    _bytes -= line->_length;
+    ::operator delete(line);
+}
+
+size_t LineStore::size() const {
+    return _count;
+}
+
+size_t LineStore::bytes() const {
+    return _bytes;
+}
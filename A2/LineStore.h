@@ -0,0 +1,97 @@
+#ifndef LineStore_h
+#define LineStore_h
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Lines shared by several buffers: each distinct line is stored once,
+ * with the number of references to it, and freed with the last one.
+ * Files that are mostly the same cost the memory of their differences.
+ *
+ * The lines are kept in an open addressing hash table (linear probing,
+ * at most half full) of pointers to them; each line is allocated along
+ * with its hash and its count in a single block.
+ *
+ * Not thread safe: the buffers sharing a store must be used by one
+ * thread at a time (reading the lines from several threads is fine).
+ */
+class LineStore {
+public:
+    /**
+     * A stored line. Its bytes follow it in memory.
+     */
+    class Line {
+    private:
+        friend class LineStore;
+
+        size_t _hash;
+        size_t _length;
+        size_t _references;
+
+    public:
+        const char* data() const;
+        size_t length() const;
+    };
+
+private:
+    static const size_t MIN_SLOTS = 1 << 10;
+
+    /**
+     * A power of 2 in size; nullptr for the empty slots.
+     */
+    vector<Line*> _slots;
+    size_t _count;
+    size_t _bytes;
+
+    static size_t hash(const char* data, const size_t length);
+
+    /**
+     * Doubles the table.
+     */
+    void grow();
+
+public:
+    LineStore();
+    ~LineStore();
+    LineStore(const LineStore&)=delete;
+    LineStore& operator=(const LineStore&)=delete;
+
+    /**
+     * Returns the stored line with the given bytes, adding it if needed,
+     * with one more reference to it.
+     */
+    Line* add(const char* data, const size_t length);
+
+    /**
+     * Adds a reference to the line.
+     */
+    void retain(Line* line);
+
+    /**
+     * Removes a reference to the line, which is freed with the last one.
+     */
+    void release(Line* line);
+
+    /**
+     * Number of distinct lines stored, and their size in bytes.
+     */
+    size_t size() const;
+    size_t bytes() const;
+};
+
+inline const char* LineStore::Line::data() const {
+    return reinterpret_cast<const char*>(this + 1);
+}
+
+inline size_t LineStore::Line::length() const {
+    return _length;
+}
+
+inline void LineStore::retain(Line* line) {
+    ++line->_references;
+}
+
+#endif /* LineStore_h */
@@ -0,0 +1,139 @@
+#include "ListBuffer.h"
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include "MappedFile.h"
+#include "Utf8.h"
+
+ListBuffer::ListBuffer() : _cursor(begin(_lines)), _cursor_index(0), _invalid_lines(0), _first_invalid(0) { }
+
+list<string>::iterator ListBuffer::seek(const size_t index) const {
+    // the cursor is kept as a mutable iterator, even by const functions.
+    list<string>& lines = const_cast<list<string>&>(_lines);
+    const size_t from_cursor = index > _cursor_index ? index - _cursor_index : _cursor_index - index;
+    const size_t from_end = lines.size() - index;
+    if (index <= from_cursor && index <= from_end) {
+        _cursor = next(begin(lines), index);
+    } else if (from_end <= from_cursor) {
+        _cursor = prev(end(lines), from_end);
+    } else {
+        advance(_cursor, static_cast<ptrdiff_t>(index) - static_cast<ptrdiff_t>(_cursor_index));
+    }
+    _cursor_index = index;
+    return _cursor;
+}
+
+bool ListBuffer::load(const string& filename) {
+    // read through MappedFile for compressed files.
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+    _lines.clear();
+    const char* position = file.data();
+    const char* last = position + file.size();
+    _invalid_lines = Utf8::invalid_lines(position, last, _first_invalid);
+    while (position < last) {
+        const char* newline = static_cast<const char*>(memchr(position, '\n', last - position));
+        const char* end = newline ? newline : last;
+        _lines.push_back(string(position, end - position));
+        position = end + 1;
+    }
+    _cursor = begin(_lines);
+    _cursor_index = 0;
+    return true;
+}
+
+size_t ListBuffer::invalid_lines(size_t& first) const {
+    first = _first_invalid;
+    return _invalid_lines;
+}
+
+size_t ListBuffer::size() const {
+    return _lines.size();
+}
+
+string ListBuffer::line(const size_t index) const {
+    return *seek(index);
+}
+
+void ListBuffer::for_each(const size_t from, const size_t to, const LineVisitor& visitor) const {
+    auto it = seek(from);
+    for (size_t i = from; i < to; ++i, ++it) {
+        visitor(it->data(), it->size());
+    }
+    // the next command is likely to go on from there.
+    _cursor = it;
+    _cursor_index = to;
+}
+
+void ListBuffer::insert(const size_t index, const LineBatch& lines) {
+    // the nodes are built apart and spliced in with a single walk.
+    list<string> inserted;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        inserted.push_back(lines.line(i));
+    }
+    const size_t count = inserted.size();
+    _lines.splice(seek(index), inserted);
+    // still on the same line, now after the lines inserted.
+    _cursor_index += count;
+}
+
+void ListBuffer::replace(const size_t index, const string& line) {
+    *seek(index) = line;
+}
+
+void ListBuffer::erase(const size_t from, const size_t to) {
+    auto first = seek(from);
+    _cursor = _lines.erase(first, next(first, to - from));
+}
+
+unique_ptr<Buffer::Lines> ListBuffer::copy(const size_t from, const size_t to) const {
+    unique_ptr<StringLines> result(new StringLines());
+    auto first = seek(from);
+    result->lines.assign(first, next(first, to - from));
+    result->bytes = 0;
+    for (auto it = begin(result->lines); it != end(result->lines); ++it) {
+        result->bytes += it->size();
+    }
+    return move(result);
+}
+
+unique_ptr<Buffer::Lines> ListBuffer::cut(const size_t from, const size_t to) {
+    // the nodes are moved, not copied.
+    unique_ptr<StringLines> result(new StringLines());
+    auto first = seek(from);
+    _cursor = next(first, to - from);
+    result->lines.splice(end(result->lines), _lines, first, _cursor);
+    result->bytes = 0;
+    for (auto it = begin(result->lines); it != end(result->lines); ++it) {
+        result->bytes += it->size();
+    }
+    return move(result);
+}
+
+void ListBuffer::insert(const size_t index, const Lines& lines) {
+    const list<string>& inserted = static_cast<const StringLines&>(lines).lines;
+    _lines.insert(seek(index), begin(inserted), end(inserted));
+    _cursor_index += inserted.size();
+}
+
+void ListBuffer::move_lines(const size_t from, const size_t to, const size_t index) {
+    if (index >= from && index <= to) {
+        return;
+    }
+    // the nodes are relinked where they are: nothing is copied.
+    auto position = seek(index);
+    auto first = seek(from);
+    _lines.splice(position, _lines, first, next(first, to - from));
+    _cursor = first;
+    _cursor_index = index > to ? index - (to - from) : index;
+}
+
+size_t ListBuffer::StringLines::size() const {
+    return lines.size();
+}
+
+size_t ListBuffer::StringLines::memory() const {
+    return bytes + lines.size() * (sizeof(string) + 2 * sizeof(void*));
+}
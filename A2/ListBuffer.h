@@ -0,0 +1,70 @@
+#ifndef ListBuffer_h
+#define ListBuffer_h
+
+#include <list>
+#include <string>
+#include "Buffer.h"
+
+using namespace std;
+
+/**
+ * Reference buffer engine: one heap allocated string per line
+ * stored in a linked list. A lookup walks the list from the start,
+ * the end or the last line reached, whichever is closest: commands
+ * on lines near the current one take time in their distance to it,
+ * not in the line number.
+ */
+class ListBuffer : public Buffer {
+private:
+    list<string> _lines;
+
+    /**
+     * The last line reached and its index (end(_lines) and size()
+     * after the last one). Kept valid by every change.
+     */
+    mutable list<string>::iterator _cursor;
+    mutable size_t _cursor_index;
+
+    /**
+     * Lines of the loaded file that are not valid UTF-8, and the first one.
+     */
+    size_t _invalid_lines, _first_invalid;
+
+    /**
+     * Returns the line at the given index (or the end), walking from
+     * the closest known position, and leaves the cursor there.
+     */
+    list<string>::iterator seek(const size_t index) const;
+
+    /**
+     * Lines cut or copied from this buffer.
+     */
+    struct StringLines : public Lines {
+        list<string> lines;
+        size_t bytes;
+
+        size_t size() const override;
+        size_t memory() const override;
+    };
+
+public:
+    ListBuffer();
+    ~ListBuffer()=default;
+    ListBuffer(const ListBuffer&)=delete;
+    ListBuffer& operator=(const ListBuffer&)=delete;
+
+    bool load(const string& filename) override;
+    size_t invalid_lines(size_t& first) const override;
+    size_t size() const override;
+    string line(const size_t index) const override;
+    void for_each(const size_t from, const size_t to, const LineVisitor& visitor) const override;
+    void insert(const size_t index, const LineBatch& lines) override;
+    void replace(const size_t index, const string& line) override;
+    void erase(const size_t from, const size_t to) override;
+    unique_ptr<Lines> copy(const size_t from, const size_t to) const override;
+    unique_ptr<Lines> cut(const size_t from, const size_t to) override;
+    void insert(const size_t index, const Lines& lines) override;
+    void move_lines(const size_t from, const size_t to, const size_t index) override;
+};
+
+#endif /* ListBuffer_h */
@@ -0,0 +1,123 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Stats.h"
+
+MappedFile::MappedFile() : _data(nullptr), _size(0), _backed(0), _mapped(false), _descriptor(-1) { }
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const string& filename) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED) {
+            madvise(address, info.st_size, MADV_SEQUENTIAL);
+            _data = static_cast<const char*>(address);
+            _size = info.st_size;
+            _backed = _size;
+            _mapped = true;
+            _descriptor = fd;
+            Stats::add(Stats::FILE_READ, _size);
+            return decompress(Compression::format(filename));
+        }
+    }
+    // not a regular file (or empty): read everything in memory instead.
+    string content;
+    char chunk[65536];
+    ssize_t count;
+    while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+        content.append(chunk, count);
+    }
+    ::close(fd);
+    if (!content.empty()) {
+        char* copy = new char[content.size()];
+        content.copy(copy, content.size());
+        _data = copy;
+        _size = content.size();
+    }
+    Stats::add(Stats::FILE_READ, _size);
+    return decompress(Compression::format(filename));
+}
+
+void MappedFile::close() {
+    if (_mapped) {
+        munmap(const_cast<char*>(_data), _size);
+        ::close(_descriptor);
+    } else {
+        delete[] _data;
+    }
+    _data = nullptr;
+    _size = 0;
+    _backed = 0;
+    _mapped = false;
+    _descriptor = -1;
+}
+
+bool MappedFile::decompress(const Compression::Format format) {
+    if (format == Compression::NONE) {
+        return true;
+    }
+    char* content;
+    size_t size;
+    const bool valid = Compression::decompress(format, _data, _size, content, size);
+    close();
+    if (valid) {
+        _data = content;
+        _size = size;
+    }
+    return valid;
+}
+
+const char* MappedFile::data() const {
+    return _data;
+}
+
+size_t MappedFile::size() const {
+    return _size;
+}
+
+int MappedFile::descriptor() const {
+    return _descriptor;
+}
+
+void MappedFile::release(const size_t offset, const size_t length) const {
+    if (!_mapped) {
+        return;
+    }
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t first = (offset + page - 1) / page * page;
+    const size_t last = (offset + length) / page * page;
+    if (first < last) {
+        madvise(const_cast<char*>(_data) + first, last - first, MADV_DONTNEED);
+    }
+}
+
+bool MappedFile::truncated() {
+    struct stat info;
+    if (!_mapped || fstat(_descriptor, &info) != 0 || static_cast<size_t>(info.st_size) >= _backed) {
+        return false;
+    }
+    // the page holding the new end reads as zeros past it, the ones after fault.
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t first = (info.st_size + page - 1) / page * page;
+    if (first < _size) {
+        mmap(const_cast<char*>(_data) + first, _size - first, PROT_READ,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    }
+    _backed = info.st_size;
+    return true;
+}
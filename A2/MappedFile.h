@@ -0,0 +1,83 @@
+#ifndef MappedFile_h
+#define MappedFile_h
+
+#include <string>
+#include "Compression.h"
+
+using namespace std;
+
+/**
+ * Read-only view of a whole file mapped in memory.
+ * Pages are only read from disk when they are accessed.
+ * Falls back to reading the file into memory when it can't be mapped.
+ * Compressed files (see Compression) are decompressed in memory.
+ */
+class MappedFile {
+private:
+    const char* _data;
+    size_t _size;
+
+    /**
+     * Bytes of the mapping the file still holds: less than _size once
+     * it was found truncated (see truncated).
+     */
+    size_t _backed;
+
+    /**
+     * True when _data comes from mmap, false when it was allocated.
+     */
+    bool _mapped;
+
+    /**
+     * The mapped file stays open so its bytes can be copied
+     * to another file without going through memory. -1 if not mapped.
+     */
+    int _descriptor;
+
+    void close();
+
+    /**
+     * Replaces the content with its decompressed form.
+     * Returns false if it is not valid for the format.
+     */
+    bool decompress(const Compression::Format format);
+
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&)=delete;
+    MappedFile& operator=(const MappedFile&)=delete;
+
+    /**
+     * Maps the given file, releasing the previous one if any.
+     * Returns false if the file could not be opened (or decompressed).
+     */
+    bool open(const string& filename);
+
+    const char* data() const;
+
+    size_t size() const;
+
+    /**
+     * File descriptor of the mapped file, or -1 if the
+     * content was read in memory instead.
+     */
+    int descriptor() const;
+
+    /**
+     * Lets the system drop the pages of [offset, offset + length) from
+     * memory; they are read from the file again if accessed. Only whole
+     * pages inside the range are dropped. Does nothing if not mapped.
+     */
+    void release(const size_t offset, const size_t length) const;
+
+    /**
+     * Checks whether the mapped file was truncated by another program
+     * since the last check. Reading its pages past the new end would then
+     * fault (SIGBUS): they are replaced by zeros first, which is what
+     * the bytes lost there read as from now on. Does nothing if not mapped.
+     */
+    bool truncated();
+};
+
+#endif /* MappedFile_h */
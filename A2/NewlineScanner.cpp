@@ -0,0 +1,132 @@
+#include "NewlineScanner.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NEWLINE_SCANNER_X86
+#endif
+
+namespace {
+
+typedef const char* (*SkipFunction)(const char*, const char*, size_t&);
+
+const char* skip_scalar(const char* position, const char* last, size_t& lines) {
+    size_t found(0);
+    while (found < lines && position < last) {
+        const char* newline = static_cast<const char*>(memchr(position, '\n', last - position));
+        if (!newline) {
+            break;
+        }
+        position = newline + 1;
+        ++found;
+    }
+    lines = found;
+    return position;
+}
+
+#ifdef NEWLINE_SCANNER_X86
+
+/**
+ * Shared by the vector versions: mask has one bit per byte of the chunk
+ * starting at position, set for newlines. Returns true once the wanted
+ * newline is in this chunk, and sets result right after it.
+ */
+inline bool skip_in_mask(uint32_t mask, const char* position, size_t& remaining,
+                         const char*& after_newline) {
+    const size_t count = __builtin_popcount(mask);
+    if (count >= remaining) {
+        for (; remaining > 1; --remaining) {
+            mask &= mask - 1;
+        }
+        remaining = 0;
+        after_newline = position + __builtin_ctz(mask) + 1;
+        return true;
+    }
+    if (count) {
+        remaining -= count;
+        after_newline = position + (31 - __builtin_clz(mask)) + 1;
+    }
+    return false;
+}
+
+/**
+ * Finishes the bytes left after the vector loop.
+ */
+inline const char* skip_tail(const char* position, const char* last, size_t& lines,
+                             size_t remaining, const char* after_newline) {
+    size_t tail(remaining);
+    const char* end = skip_scalar(position, last, tail);
+    if (tail) {
+        after_newline = end;
+    }
+    lines -= remaining - tail;
+    return after_newline;
+}
+
+__attribute__((target("sse2,popcnt")))
+const char* skip_sse2(const char* position, const char* last, size_t& lines) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const char* after_newline = position;
+    size_t remaining(lines);
+    for (; remaining > 0 && last - position >= 16; position += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position));
+        const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        if (skip_in_mask(mask, position, remaining, after_newline)) {
+            return after_newline;
+        }
+    }
+    return skip_tail(position, last, lines, remaining, after_newline);
+}
+
+__attribute__((target("avx2,popcnt")))
+const char* skip_avx2(const char* position, const char* last, size_t& lines) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const char* after_newline = position;
+    size_t remaining(lines);
+    for (; remaining > 0 && last - position >= 32; position += 32) {
+        const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(position));
+        const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+        if (skip_in_mask(mask, position, remaining, after_newline)) {
+            return after_newline;
+        }
+    }
+    return skip_tail(position, last, lines, remaining, after_newline);
+}
+
+#endif
+
+const char* implementation_name("scalar");
+
+SkipFunction select_implementation() {
+#ifdef NEWLINE_SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        implementation_name = "avx2";
+        return skip_avx2;
+    }
+    if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+        implementation_name = "sse2";
+        return skip_sse2;
+    }
+#endif
+    return skip_scalar;
+}
+
+const SkipFunction skip_implementation = select_implementation();
+
+}
+
+const char* NewlineScanner::skip(const char* position, const char* last, size_t& lines) {
+    return skip_implementation(position, last, lines);
+}
+
+size_t NewlineScanner::count(const char* data, const size_t size) {
+    size_t lines(SIZE_MAX);
+    skip_implementation(data, data + size, lines);
+    return lines;
+}
+
+const char* NewlineScanner::implementation() {
+    return implementation_name;
+}
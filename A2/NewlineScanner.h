@@ -0,0 +1,32 @@
+#ifndef NewlineScanner_h
+#define NewlineScanner_h
+
+#include <cstddef>
+
+/**
+ * Finds newline characters in raw bytes. Uses AVX2 or SSE2 when the
+ * processor supports it (checked once at runtime) and memchr otherwise.
+ */
+class NewlineScanner {
+public:
+    NewlineScanner()=delete;
+
+    /**
+     * Moves past up to the given number of newlines in [position, last).
+     * Returns the position right after the last newline skipped
+     * (or position if none) and sets lines to the number skipped.
+     */
+    static const char* skip(const char* position, const char* last, size_t& lines);
+
+    /**
+     * Returns the number of newlines in the given bytes.
+     */
+    static size_t count(const char* data, const size_t size);
+
+    /**
+     * Name of the implementation picked for this processor.
+     */
+    static const char* implementation();
+};
+
+#endif /* NewlineScanner_h */
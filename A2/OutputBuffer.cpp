@@ -0,0 +1,112 @@
+#include "OutputBuffer.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "Stats.h"
+
+const size_t OutputBuffer::BUFFER_SIZE;
+const size_t OutputBuffer::MIN_SLICE;
+const size_t OutputBuffer::MAX_PARTS;
+
+OutputBuffer::OutputBuffer(ostream& stream, const int descriptor) :
+_stream(stream), _descriptor(descriptor), _buffer(new char[BUFFER_SIZE]), _used(0), _copied(0),
+_failed(false) { }
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+    delete[] _buffer;
+}
+
+void OutputBuffer::append(const char* data, const size_t length) {
+    size_t done(0);
+    while (done < length) {
+        if (_used == BUFFER_SIZE) {
+            flush();
+        }
+        const size_t count = min(length - done, BUFFER_SIZE - _used);
+        memcpy(_buffer + _used, data + done, count);
+        _used += count;
+        done += count;
+    }
+}
+
+void OutputBuffer::append(const char character) {
+    if (_used == BUFFER_SIZE) {
+        flush();
+    }
+    _buffer[_used++] = character;
+}
+
+void OutputBuffer::append_number(size_t number) {
+    // digits are produced from the last one.
+    char digits[20];
+    char* first = digits + sizeof(digits);
+    do {
+        *--first = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while (number > 0);
+    append(first, digits + sizeof(digits) - first);
+}
+
+void OutputBuffer::append_line(const char* data, const size_t length) {
+    if (_descriptor < 0 || length < MIN_SLICE) {
+        append(data, length);
+        append('\n');
+        return;
+    }
+    close_run();
+    _parts.push_back({ const_cast<char*>(data), length });
+    append('\n');
+    if (_parts.size() >= MAX_PARTS) {
+        flush();
+    }
+}
+
+void OutputBuffer::flush() {
+    if (_descriptor < 0) {
+        if (_used > 0) {
+            _stream.write(_buffer, _used);
+            Stats::add(Stats::OUTPUT_WRITTEN, _used);
+        }
+    } else {
+        close_run();
+        if (!_parts.empty()) {
+            // what the stream holds comes first.
+            _stream.flush();
+            write_parts();
+        }
+    }
+    _parts.clear();
+    _used = 0;
+    _copied = 0;
+}
+
+void OutputBuffer::close_run() {
+    if (_used > _copied) {
+        _parts.push_back({ _buffer + _copied, _used - _copied });
+        _copied = _used;
+    }
+}
+
+void OutputBuffer::write_parts() {
+    size_t first(0);
+    while (!_failed && first < _parts.size()) {
+        const int count = static_cast<int>(min(_parts.size() - first, MAX_PARTS));
+        ssize_t written = writev(_descriptor, &_parts[first], count);
+        if (written < 0) {
+            if (errno != EINTR) {
+                _failed = true;
+            }
+            continue;
+        }
+        Stats::add(Stats::OUTPUT_WRITTEN, written);
+        // skip what was written, in case it was only partially.
+        for (; first < _parts.size() && static_cast<size_t>(written) >= _parts[first].iov_len; ++first) {
+            written -= _parts[first].iov_len;
+        }
+        if (first < _parts.size()) {
+            _parts[first].iov_base = static_cast<char*>(_parts[first].iov_base) + written;
+            _parts[first].iov_len -= written;
+        }
+    }
+}
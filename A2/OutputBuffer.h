@@ -0,0 +1,96 @@
+#ifndef OutputBuffer_h
+#define OutputBuffer_h
+
+#include <ostream>
+#include <vector>
+#include <sys/uio.h>
+
+using namespace std;
+
+/**
+ * Collects the output of a command in one large buffer, so printing
+ * many lines costs a few system calls instead of one (or more) per line.
+ * Everything is written when flush is called, or when the buffer fills.
+ *
+ * When the output goes straight to a file descriptor, long lines are not
+ * copied: the buffer only keeps a pointer to them, and the pieces are
+ * written together with writev. Those lines must then stay valid until
+ * the next flush.
+ */
+class OutputBuffer {
+private:
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    /**
+     * Lines at least that long are written from where they are
+     * instead of being copied (with a file descriptor only).
+     */
+    static const size_t MIN_SLICE = 512;
+
+    /**
+     * Number of pieces written by a single writev.
+     */
+    static const size_t MAX_PARTS = 512;
+
+    ostream& _stream;
+    const int _descriptor;
+
+    char* _buffer;
+    size_t _used;
+
+    /**
+     * Where the bytes of _buffer not yet in _parts start.
+     */
+    size_t _copied;
+
+    /**
+     * What is waiting to be written, in order: runs of _buffer and lines
+     * outside of it. Only used with a file descriptor.
+     */
+    vector<iovec> _parts;
+
+    /**
+     * Set when writing failed, after which the output is dropped.
+     */
+    bool _failed;
+
+    /**
+     * Adds the bytes of _buffer since the last part as a part.
+     */
+    void close_run();
+
+    void write_parts();
+
+public:
+    /**
+     * Writes to the stream, or directly to the descriptor if it is not -1.
+     * The descriptor must be the one the stream writes to: the stream is
+     * flushed before anything is written to it.
+     */
+    OutputBuffer(ostream& stream, const int descriptor=-1);
+    ~OutputBuffer();
+    OutputBuffer(const OutputBuffer&)=delete;
+    OutputBuffer& operator=(const OutputBuffer&)=delete;
+
+    void append(const char* data, const size_t length);
+
+    void append(const char character);
+
+    /**
+     * Appends the number in decimal.
+     */
+    void append_number(size_t number);
+
+    /**
+     * Appends a line followed by a newline. Long lines are not copied
+     * (see above), so they must not change until the next flush.
+     */
+    void append_line(const char* data, const size_t length);
+
+    /**
+     * Writes everything appended so far.
+     */
+    void flush();
+};
+
+#endif /* OutputBuffer_h */
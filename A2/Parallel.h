@@ -0,0 +1,30 @@
+#ifndef Parallel_h
+#define Parallel_h
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Splits [0, size) into one chunk per core, with at least min_chunk
+ * elements in each, and calls function(chunk, begin, end) for every
+ * chunk on its own thread. The calling thread handles the first chunk.
+ * Returns the number of chunks once they are all done.
+ */
+template <typename Function>
+size_t parallel_chunks(const size_t size, const size_t min_chunk, Function function) {
+    const size_t chunks = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), size / max<size_t>(1, min_chunk)));
+    vector<thread> workers;
+    for (size_t i = 1; i < chunks; ++i) {
+        workers.push_back(thread(function, i, size * i / chunks, size * (i + 1) / chunks));
+    }
+    function(0, 0, size / chunks);
+    for (auto it = begin(workers); it != end(workers); ++it) {
+        it->join();
+    }
+    return chunks;
+}
+
+#endif /* Parallel_h */
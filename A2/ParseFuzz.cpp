@@ -0,0 +1,431 @@
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include "Command.h"
+
+using namespace std;
+
+/**
+ * Checks Command::parse against the std::regex grammar it replaced, on a
+ * generated corpus of commands: addresses, '.', '$', commas, stray blanks,
+ * every command letter, and characters that are not part of the grammar.
+ *
+ * Whatever the regex parser accepts must parse to the same type, range
+ * and line number. Whatever it refuses must be refused too, unless the
+ * new parser reads it as one of the commands added since (t, m, j, e, U,
+ * R, g, v, searches and the ':' commands), which only ever extend the
+ * grammar. The ':' commands are also checked on their own, blanks around.
+ * Usage: ./parse_fuzz [number_of_commands [seed]]
+ */
+
+namespace {
+
+/**
+ * Whether the command type was added after the regex grammar.
+ */
+bool is_extension(const CommandType type) {
+    switch (type) {
+        case UNDO:
+        case REDO:
+        case GLOBAL:
+        case SEARCH_FORWARD:
+        case SEARCH_BACKWARD:
+        case STATS:
+        case LIST_FILES:
+        case SWITCH_FILE:
+        case NEXT_FILE:
+        case PREVIOUS_FILE:
+        case COPY:
+        case MOVE:
+        case JOIN:
+        case RELOAD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * The ':' commands, with the type and file number each one parses to.
+ */
+const struct {
+    const char* input;
+    CommandType type;
+    size_t line_number;
+} NAMED[] = {
+    {":stats", STATS, 1},
+    {":ls", LIST_FILES, 1},
+    {":bn", NEXT_FILE, 1},
+    {":bp", PREVIOUS_FILE, 1},
+    {":b3", SWITCH_FILE, 3},
+    {":b 12", SWITCH_FILE, 12},
+    {":b", INVALID, 1},
+    {":b0", INVALID, 1},
+    {":bx", INVALID, 1},
+    {":stat", INVALID, 1},
+    {":statsx", INVALID, 1},
+};
+
+const size_t CURRENT_LINE = 7;
+const size_t LAST_LINE = 40;
+
+/**
+ * What a parser made of a command.
+ */
+struct Parsed {
+    bool accepted;
+    CommandType type;
+    size_t range_start, range_end, line_number;
+
+    Parsed() : accepted(false), type(INVALID), range_start(1), range_end(1), line_number(1) { }
+
+    bool operator==(const Parsed& other) const {
+        if (accepted != other.accepted)
+            return false;
+        return !accepted || (type == other.type && range_start == other.range_start
+                             && range_end == other.range_end && line_number == other.line_number);
+    }
+};
+
+ostream& operator<<(ostream& stream, const Parsed& parsed) {
+    if (!parsed.accepted)
+        return stream << "refused";
+    return stream << "type " << parsed.type << ", range " << parsed.range_start << "," << parsed.range_end
+                  << ", line " << parsed.line_number;
+}
+
+/**
+ * The parser as it was with std::regex, kept as is but for returning
+ * its fields: the reference the new one is held to.
+ */
+class RegexParser {
+private:
+    size_t _current_line, _last_line;
+    Parsed _parsed;
+
+    size_t get_numerical_value(const string& val) {
+        if (val == ".")
+            return _current_line;
+        if (val == "$")
+            return _last_line;
+        return stoul(val);
+    }
+
+    CommandType get_type_from_character(const string& character) {
+        if (character.size() > 1) {
+            return INVALID;
+        } else if (character.size() == 0) {
+            return PRINT_CURRENT_LINE;
+        }
+        switch (character[0]) {
+            case 'a':
+                return APPEND;
+            case 'i':
+                return INSERT;
+            case 'r':
+                return REMOVE;
+            case 'p':
+                return PRINT;
+            case 'n':
+                return PRINT_WITH_LINE_NUM;
+            case 'c':
+                return CHANGE;
+            case 'u':
+                return MOVE_UP;
+            case 'd':
+                return MOVE_DOWN;
+            case 'w':
+                return WRITE;
+            case 'q':
+                return QUIT;
+            case '=':
+                return PRINT_CURRENT_LINE;
+            default:
+                return INVALID;
+        }
+    }
+
+    bool parse_single_character(char input) {
+        switch (input) {
+            case '=':
+                _parsed.type = PRINT_CURRENT_LINE;
+                _parsed.line_number = _current_line;
+                return true;
+            case ',':
+                _parsed.type = PRINT;
+                _parsed.range_start = 1;
+                _parsed.range_end = _last_line;
+                return true;
+            case '$':
+                _parsed.type = PRINT;
+                _parsed.range_start = _last_line;
+                _parsed.range_end = _last_line;
+                return true;
+            case '.':
+                _parsed.type = PRINT;
+                _parsed.range_start = _current_line;
+                _parsed.range_end = _current_line;
+                return true;
+            case 'w':
+                _parsed.type = WRITE;
+                return true;
+            case 'q':
+                _parsed.type = QUIT;
+                return true;
+            case 'i':
+                _parsed.type = INSERT;
+                _parsed.range_start = _current_line;
+                _parsed.range_end = _parsed.range_start;
+                return true;
+            case 'a':
+                _parsed.type = APPEND;
+                _parsed.range_start = _current_line;
+                _parsed.range_end = _parsed.range_start;
+                return true;
+            case 'p':
+                _parsed.type = PRINT;
+                _parsed.range_start = _current_line;
+                _parsed.range_end = _current_line;
+                return true;
+            case 'n':
+                _parsed.type = PRINT_WITH_LINE_NUM;
+                _parsed.range_start = _current_line;
+                _parsed.range_end = _current_line;
+                return true;
+            case 'c':
+                _parsed.type = CHANGE;
+                _parsed.range_start = _current_line;
+                _parsed.range_end = _current_line;
+                return true;
+            case 'u':
+                _parsed.type = MOVE_UP;
+                _parsed.line_number = 1;
+                return true;
+            case 'd':
+                _parsed.type = MOVE_DOWN;
+                _parsed.line_number = 1;
+                return true;
+            case 'r':
+                _parsed.type = REMOVE;
+                _parsed.range_start = _current_line;
+                _parsed.range_end = _current_line;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool parse_fields(const string& input) {
+        string sanitized(input);
+        Command::replace_all(sanitized, " ", "");
+        Command::replace_all(sanitized, "\t", "");
+
+        if (sanitized.size() == 0) {
+            _parsed.type = MOVE_DOWN;
+            _parsed.line_number = 1;
+            return true;
+        }
+        if (sanitized.size() == 1 && parse_single_character(sanitized[0]))
+            return true;
+
+        static const regex pattern("^(?:"
+                                   "(([0-9]+),?[0-9]*([u|d]))|"
+                                   "(([0-9]+|\\.|\\$),([0-9]+|\\.|\\$)([r|p|c|n]))|"
+                                   "(([0-9]+|\\.|\\$)([r|p|c|n]))|"
+                                   "(,([0-9]+|\\.|\\$)([r|p|c|n]))|"
+                                   "(([0-9]+|\\.|\\$),([r|p|c|n]))|"
+                                   "(([0-9]+|\\.|\\$),([0-9]+|\\.|\\$))|"
+                                   "(([0-9]+))|"
+                                   "(([0-9]+|\\.|\\$),)|"
+                                   "(([0-9]+|\\.|\\$),?[0-9]*([a|i|]))"
+                                   ")$");
+        smatch result;
+        regex_match(sanitized, result, pattern);
+        if (result.size() == 0)
+            return false;
+        if (result.str(1).size() > 0) {
+            _parsed.type = get_type_from_character(result.str(3));
+            _parsed.line_number = get_numerical_value(result.str(2));
+        } else if (result.str(4).size() > 0) {
+            _parsed.type = get_type_from_character(result.str(7));
+            _parsed.range_start = get_numerical_value(result.str(5));
+            _parsed.range_end = get_numerical_value(result.str(6));
+        } else if (result.str(8).size() > 0) {
+            _parsed.type = get_type_from_character(result.str(10));
+            _parsed.range_start = get_numerical_value(result.str(9));
+            _parsed.range_end = _parsed.range_start;
+        } else if (result.str(11).size() > 0) {
+            _parsed.type = get_type_from_character(result.str(13));
+            _parsed.range_start = _current_line;
+            _parsed.range_end = get_numerical_value(result.str(12));
+        } else if (result.str(14).size() > 0) {
+            _parsed.type = get_type_from_character(result.str(16));
+            _parsed.range_start = get_numerical_value(result.str(15));
+            _parsed.range_end = _current_line;
+        } else if (result.str(17).size() > 0) {
+            _parsed.type = PRINT;
+            _parsed.range_start = get_numerical_value(result.str(18));
+            _parsed.range_end = get_numerical_value(result.str(19));
+        } else if (result.str(20).size() > 0) {
+            _parsed.type = PRINT;
+            _parsed.range_start = get_numerical_value(result.str(21));
+            _parsed.range_end = _parsed.range_start;
+        } else if (result.str(22).size() > 0) {
+            _parsed.type = PRINT;
+            _parsed.range_start = get_numerical_value(result.str(23));
+            _parsed.range_end = _current_line;
+        } else if (result.str(24).size() > 0) {
+            _parsed.type = get_type_from_character(result.str(26));
+            _parsed.range_start = get_numerical_value(result.str(25));
+            _parsed.range_end = _parsed.range_start;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+public:
+    RegexParser(const size_t current_line, const size_t last_line) : _current_line(current_line),
+        _last_line(last_line) { }
+
+    Parsed parse(const string& input) {
+        try {
+            _parsed.accepted = parse_fields(input);
+        } catch (const out_of_range&) {
+            // stoul on a number too big: the old parser threw.
+            _parsed.accepted = false;
+        }
+        return _parsed;
+    }
+};
+
+Parsed parse_with_command(const string& input) {
+    Command command(CURRENT_LINE, LAST_LINE);
+    Parsed parsed;
+    parsed.accepted = command.parse(input);
+    parsed.type = command.getType();
+    parsed.range_start = command.getRangeStart();
+    parsed.range_end = command.getRangeEnd();
+    parsed.line_number = command.getLineNumber();
+    return parsed;
+}
+
+string random_blanks(mt19937& random) {
+    string blanks;
+    for (size_t count = random() % 3; count > 0; --count)
+        blanks += random() % 2 ? ' ' : '\t';
+    return blanks;
+}
+
+string random_number(mt19937& random) {
+    switch (random() % 8) {
+        case 0:
+            return "0";
+        case 1:
+            // too big for a size_t.
+            return "184467440737095516160";
+        case 2:
+            return "18446744073709551615";
+        default:
+            return to_string(random() % (random() % 2 ? 10 : 100000));
+    }
+}
+
+string random_address(mt19937& random) {
+    switch (random() % 4) {
+        case 0:
+            return ".";
+        case 1:
+            return "$";
+        default:
+            return random_number(random);
+    }
+}
+
+/**
+ * Any sequence of the pieces commands are made of.
+ */
+string random_tokens(mt19937& random) {
+    static const string characters(".$,,,  \t+-x|=aiurdpcnwqtmjeURgv/?:");
+    string command;
+    const size_t tokens = random() % 7;
+    for (size_t i = 0; i < tokens; ++i) {
+        if (random() % 3 == 0)
+            command += random_number(random);
+        else
+            command += characters[random() % characters.size()];
+    }
+    return command;
+}
+
+/**
+ * A command shaped like the grammar's ([A][,[A]][letter]), with blanks
+ * and the odd extra character thrown in, so that most of them are valid.
+ */
+string random_shaped(mt19937& random) {
+    static const string letters("aiurdpcnwq=|+-tmj");
+    string command;
+    if (random() % 4)
+        command += random_address(random);
+    if (random() % 2)
+        command += ',';
+    if (random() % 2)
+        command += random_address(random);
+    if (random() % 4)
+        command += letters[random() % letters.size()];
+    for (size_t blanks = random() % 3; blanks > 0; --blanks)
+        command.insert(random() % (command.size() + 1), 1, random() % 2 ? ' ' : '\t');
+    if (random() % 10 == 0)
+        command.insert(random() % (command.size() + 1), random_tokens(random));
+    return command;
+}
+
+}
+
+int main(int argc, const char * argv[]) {
+    size_t count(200000);
+    unsigned long seed(1);
+    char* end(nullptr);
+    if (argc > 3 || (argc > 1 && (count = strtoul(argv[1], &end, 10), *end != '\0'))
+        || (argc > 2 && (seed = strtoul(argv[2], &end, 10), *end != '\0'))) {
+        cerr << "Usage: " << argv[0] << " [number_of_commands [seed]]" << endl;
+        return EXIT_FAILURE;
+    }
+    mt19937 random(seed);
+    size_t accepted(0), extended(0), mismatches(0);
+    for (size_t i = 0; i < count; ++i) {
+        const string input = (random() % 2) ? random_shaped(random) : random_tokens(random);
+        const Parsed expected = RegexParser(CURRENT_LINE, LAST_LINE).parse(input);
+        const Parsed actual = parse_with_command(input);
+        accepted += expected.accepted;
+        if (expected == actual)
+            continue;
+        if (!expected.accepted && actual.accepted && is_extension(actual.type)) {
+            ++extended;
+            continue;
+        }
+        if (++mismatches <= 20) {
+            cout << "\"" << input << "\": expected " << expected << ", got " << actual << endl;
+        }
+    }
+    for (size_t i = 0; i < count / 100; ++i) {
+        const auto& named = NAMED[random() % (sizeof(NAMED) / sizeof(NAMED[0]))];
+        const string input = random_blanks(random) + named.input + random_blanks(random);
+        Parsed expected;
+        expected.accepted = named.type != INVALID;
+        expected.type = named.type;
+        expected.line_number = named.line_number;
+        const Parsed actual = parse_with_command(input);
+        if (expected == actual)
+            continue;
+        if (++mismatches <= 20) {
+            cout << "\"" << input << "\": expected " << expected << ", got " << actual << endl;
+        }
+    }
+    cout << count << " commands, " << accepted << " valid, " << extended << " only valid now, "
+         << mismatches << " mismatches" << endl;
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include "Pattern.h"
+
+Pattern::~Pattern() {
+    clear();
+}
+
+bool Pattern::compile(const string& source, const size_t copies, string& error) {
+    clear();
+    // regex_t may not be moved once compiled: no reallocation.
+    _compiled.reserve(copies);
+    for (size_t i = 0; i < copies; ++i) {
+        _compiled.push_back(regex_t());
+        const int result = regcomp(&_compiled.back(), source.c_str(), REG_NOSUB);
+        if (result != 0) {
+            char message[256];
+            regerror(result, &_compiled.back(), message, sizeof(message));
+            error = message;
+            _compiled.pop_back();
+            clear();
+            return false;
+        }
+    }
+    _source = source;
+    return true;
+}
+
+const string& Pattern::source() const {
+    return _source;
+}
+
+bool Pattern::empty() const {
+    return _compiled.empty();
+}
+
+bool Pattern::matches(const char* data, const size_t length, const size_t copy) const {
+    // REG_STARTEND gives the length: the line doesn't need a terminating null.
+    regmatch_t range;
+    range.rm_so = 0;
+    range.rm_eo = length;
+    return regexec(&_compiled[copy], data, 1, &range, REG_STARTEND) == 0;
+}
+
+void Pattern::clear() {
+    for (auto it = begin(_compiled); it != end(_compiled); ++it) {
+        regfree(&*it);
+    }
+    _compiled.clear();
+    _source.clear();
+}
@@ -0,0 +1,52 @@
+#ifndef Pattern_h
+#define Pattern_h
+
+#include <string>
+#include <vector>
+#include <regex.h>
+
+using namespace std;
+
+/**
+ * A compiled regular expression (POSIX basic syntax, as in ed) that
+ * can be matched against lines that are not null terminated.
+ *
+ * The C library serializes the matches of a compiled expression with a
+ * lock, so the pattern is compiled once per thread that will use it:
+ * each thread matches with its own copy and they never wait on each other.
+ */
+class Pattern {
+private:
+    vector<regex_t> _compiled;
+    string _source;
+
+    void clear();
+
+public:
+    Pattern()=default;
+    ~Pattern();
+    Pattern(const Pattern&)=delete;
+    Pattern& operator=(const Pattern&)=delete;
+
+    /**
+     * Compiles the expression, with the given number of copies.
+     * Returns false and sets error if the expression is invalid;
+     * the pattern is then empty.
+     */
+    bool compile(const string& source, const size_t copies, string& error);
+
+    /**
+     * The expression, empty if nothing is compiled.
+     */
+    const string& source() const;
+
+    bool empty() const;
+
+    /**
+     * Whether the expression matches somewhere in the line.
+     * Threads matching at the same time must use different copies.
+     */
+    bool matches(const char* data, const size_t length, const size_t copy=0) const;
+};
+
+#endif /* Pattern_h */
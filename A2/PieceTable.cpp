@@ -0,0 +1,397 @@
+#include "PieceTable.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include "FileWriter.h"
+#include "NewlineScanner.h"
+#include "Utf8.h"
+
+const size_t PieceTable::MAX_BLOCK_SIZE;
+const size_t PieceTable::MIN_BYTES_PER_THREAD;
+const size_t PieceTable::RELEASE_BYTES;
+const size_t PieceTable::WINDOW_BLOCKS;
+
+PieceTable::Block::Block() : pieces(make_shared<vector<Piece>>()),
+    first_byte(0), last_byte(0), lines(0), loaded(true) { }
+
+PieceTable::Block::Block(vector<Piece>&& pieces) : pieces(make_shared<vector<Piece>>(move(pieces))),
+    first_byte(0), last_byte(0), lines(0), loaded(true) { }
+
+PieceTable::Block::Block(const size_t first_byte, const size_t last_byte, const size_t lines) :
+    first_byte(first_byte), last_byte(last_byte), lines(lines), loaded(false) { }
+
+size_t PieceTable::Block::size() const {
+    return loaded ? pieces->size() : lines;
+}
+
+PieceTable::PieceTable(const size_t window) : _original(make_shared<MappedFile>()), _size(0),
+    _invalid_lines(0), _first_invalid(0), _window(window) { }
+
+bool PieceTable::load(const string& filename) {
+    // a new file: snapshots may still be reading the previous one,
+    // and the lines stay as they are if it can't be opened.
+    shared_ptr<MappedFile> original = make_shared<MappedFile>();
+    if (!original->open(filename)) {
+        return false;
+    }
+    _original = original;
+    _added.clear();
+    _blocks.clear();
+    _recent.clear();
+    // only find the block boundaries here, the pieces are built on demand.
+    // Big files are split in chunks of whole lines indexed in parallel.
+    const size_t size = _original->size();
+    const size_t threads = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), size / MIN_BYTES_PER_THREAD));
+    vector<size_t> bounds(1, 0);
+    for (size_t i = 1; i < threads; ++i) {
+        const size_t nominal = max(bounds.back(), size / threads * i);
+        const char* newline = static_cast<const char*>(memchr(_original->data() + nominal, '\n', size - nominal));
+        bounds.push_back(newline ? (newline - _original->data() + 1) : size);
+    }
+    bounds.push_back(size);
+    vector<vector<Block>> chunks(threads);
+    vector<size_t> invalid(threads), first_invalid(threads);
+    vector<thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.push_back(thread(&PieceTable::index_range, this, bounds[i], bounds[i+1], ref(chunks[i]),
+                                 ref(invalid[i]), ref(first_invalid[i])));
+    }
+    index_range(bounds[0], bounds[1], chunks[0], invalid[0], first_invalid[0]);
+    for (auto it = begin(workers); it != end(workers); ++it) {
+        it->join();
+    }
+    _invalid_lines = 0;
+    size_t lines(0);
+    for (size_t i = 0; i < threads; ++i) {
+        if (invalid[i] && !_invalid_lines) {
+            _first_invalid = lines + first_invalid[i];
+        }
+        _invalid_lines += invalid[i];
+        for (auto it = begin(chunks[i]); it != end(chunks[i]); ++it) {
+            lines += it->lines;
+        }
+        _blocks.insert(end(_blocks), make_move_iterator(begin(chunks[i])), make_move_iterator(end(chunks[i])));
+    }
+    update_prefix(0);
+    return true;
+}
+
+size_t PieceTable::invalid_lines(size_t& first) const {
+    first = _first_invalid;
+    return _invalid_lines;
+}
+
+bool PieceTable::truncated() {
+    // snapshots share the mapping, and are guarded with it.
+    return _original->truncated();
+}
+
+size_t PieceTable::size() const {
+    return _size;
+}
+
+string PieceTable::line(const size_t index) const {
+    size_t offset;
+    const size_t block = locate(index, offset);
+    const Piece& piece = pieces(block)[offset];
+    return string(data(piece), piece.length);
+}
+
+void PieceTable::for_each(const size_t from, const size_t to, const LineVisitor& visitor) const {
+    if (from >= to) {
+        return;
+    }
+    size_t offset;
+    size_t block = locate(from, offset);
+    for (size_t remaining = to - from; remaining > 0; ++block, offset = 0) {
+        const vector<Piece>& block_pieces = pieces(block);
+        for (; offset < block_pieces.size() && remaining > 0; ++offset, --remaining) {
+            visitor(data(block_pieces[offset]), block_pieces[offset].length);
+        }
+    }
+}
+
+void PieceTable::insert(const size_t index, const LineBatch& lines) {
+    if (lines.empty()) {
+        return;
+    }
+    vector<Piece> added;
+    added.reserve(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        added.push_back(add(lines.data(i), lines.length(i)));
+    }
+    insert_pieces(index, added);
+}
+
+void PieceTable::insert(const size_t index, const Lines& lines) {
+    insert_pieces(index, static_cast<const PieceLines&>(lines).pieces);
+}
+
+void PieceTable::insert_pieces(const size_t index, const vector<Piece>& added) {
+    if (added.empty()) {
+        return;
+    }
+    size_t block(0), offset(0);
+    if (_blocks.empty()) {
+        _blocks.push_back(Block());
+    } else if (index >= _size) {
+        block = _blocks.size() - 1;
+        offset = _blocks[block].size();
+    } else {
+        block = locate(index, offset);
+    }
+
+    if (_blocks[block].size() + added.size() <= MAX_BLOCK_SIZE) {
+        vector<Piece>& target = mutable_pieces(block);
+        target.insert(next(begin(target), offset), begin(added), end(added));
+    } else {
+        // large insert: cut the block at the insertion point and
+        // add the new lines as whole blocks in between.
+        split_block(block, offset);
+        size_t position = (offset == 0) ? block : block + 1;
+        if (_blocks[block].size() == 0) { // only happens when the buffer was empty.
+            _blocks.erase(next(begin(_blocks), block));
+        }
+        vector<Block> chunks;
+        for (size_t first = 0; first < added.size(); first += MAX_BLOCK_SIZE) {
+            const size_t last = min(first + MAX_BLOCK_SIZE, added.size());
+            chunks.push_back(Block(vector<Piece>(next(begin(added), first), next(begin(added), last))));
+        }
+        _blocks.insert(next(begin(_blocks), position),
+                       make_move_iterator(begin(chunks)), make_move_iterator(end(chunks)));
+    }
+    update_prefix(block);
+}
+
+void PieceTable::replace(const size_t index, const string& line) {
+    size_t offset;
+    const size_t block = locate(index, offset);
+    mutable_pieces(block)[offset] = add(line.data(), line.size());
+}
+
+void PieceTable::erase(const size_t from, const size_t to) {
+    if (from >= to) {
+        return;
+    }
+    size_t first_offset, last_offset;
+    const size_t first_block = locate(from, first_offset);
+    const size_t last_block = locate(to - 1, last_offset);
+    if (first_block == last_block) {
+        vector<Piece>& block_pieces = mutable_pieces(first_block);
+        block_pieces.erase(next(begin(block_pieces), first_offset), next(begin(block_pieces), last_offset + 1));
+    } else {
+        // blocks in between are dropped whole, without ever being loaded.
+        vector<Piece>& head = mutable_pieces(first_block);
+        head.erase(next(begin(head), first_offset), end(head));
+        vector<Piece>& tail = mutable_pieces(last_block);
+        tail.erase(begin(tail), next(begin(tail), last_offset + 1));
+    }
+    // drop the blocks in between along with the ones that became empty.
+    const size_t erase_from = _blocks[first_block].size() == 0 ? first_block : first_block + 1;
+    const size_t erase_to = _blocks[last_block].size() == 0 ? last_block + 1 : last_block;
+    if (erase_from < erase_to) {
+        _blocks.erase(next(begin(_blocks), erase_from), next(begin(_blocks), erase_to));
+    }
+    update_prefix(min(first_block, _blocks.size()));
+}
+
+void PieceTable::write_to(FileWriter& writer) const {
+    const char* const start = _original->data();
+    const size_t size = _original->size();
+    const bool missing_newline = size > 0 && start[size - 1] != '\n';
+    // [run_begin, run_end) is the run of original bytes not written yet.
+    size_t run_begin(0), run_end(0);
+    auto write_run = [&]() {
+        if (run_end > run_begin) {
+            writer.append_from(_original->descriptor(), run_begin, start + run_begin, run_end - run_begin);
+            if (run_end == size && missing_newline) {
+                writer.append("\n", 1);
+            }
+        }
+        run_begin = run_end = 0;
+    };
+    auto extend_run = [&](size_t first, size_t last) {
+        if (run_end == run_begin || first != run_end) {
+            write_run();
+            run_begin = first;
+        }
+        run_end = min(last, size);
+    };
+    for (auto block = begin(_blocks); block != end(_blocks); ++block) {
+        if (!block->loaded) {
+            extend_run(block->first_byte, block->last_byte);
+            continue;
+        }
+        for (auto piece = begin(*block->pieces); piece != end(*block->pieces); ++piece) {
+            if (piece->source == ORIGINAL) {
+                // the line along with its newline.
+                extend_run(piece->offset, piece->offset + piece->length + 1);
+            } else {
+                write_run();
+                writer.append_line(data(*piece), piece->length);
+            }
+        }
+    }
+    write_run();
+}
+
+unique_ptr<Buffer::Lines> PieceTable::copy(const size_t from, const size_t to) const {
+    unique_ptr<PieceLines> result(new PieceLines());
+    result->pieces.reserve(to - from);
+    if (from < to) {
+        size_t offset;
+        size_t block = locate(from, offset);
+        for (size_t remaining = to - from; remaining > 0; ++block, offset = 0) {
+            const vector<Piece>& block_pieces = pieces(block);
+            const size_t count = min(remaining, block_pieces.size() - offset);
+            result->pieces.insert(end(result->pieces), next(begin(block_pieces), offset),
+                                  next(begin(block_pieces), offset + count));
+            remaining -= count;
+        }
+    }
+    return move(result);
+}
+
+unique_ptr<Buffer> PieceTable::snapshot() const {
+    return unique_ptr<Buffer>(new PieceTable(*this));
+}
+
+unique_ptr<Buffer::Lines> PieceTable::cut(const size_t from, const size_t to) {
+    unique_ptr<Lines> result = copy(from, to);
+    erase(from, to);
+    return result;
+}
+
+size_t PieceTable::PieceLines::size() const {
+    return pieces.size();
+}
+
+size_t PieceTable::PieceLines::memory() const {
+    return pieces.capacity() * sizeof(Piece);
+}
+
+size_t PieceTable::locate(const size_t index, size_t& offset) const {
+    const size_t block = upper_bound(begin(_prefix), end(_prefix), index) - begin(_prefix) - 1;
+    offset = index - _prefix[block];
+    return block;
+}
+
+void PieceTable::index_range(const size_t first, const size_t last, vector<Block>& blocks,
+                             size_t& invalid, size_t& first_invalid) const {
+    const char* const start = _original->data();
+    const char* const end_of_range = start + last;
+    const char* position = start + first;
+    const char* released = position;
+    size_t indexed(0);
+    invalid = 0;
+    while (position < end_of_range) {
+        size_t lines(MAX_BLOCK_SIZE);
+        const char* next_block = NewlineScanner::skip(position, end_of_range, lines);
+        if (lines < MAX_BLOCK_SIZE && next_block < end_of_range) {
+            // last line of the file without a newline.
+            next_block = end_of_range;
+            ++lines;
+        }
+        // checked while the block is still in the cache.
+        size_t first_in_block;
+        const size_t invalid_in_block = Utf8::invalid_lines(position, next_block, first_in_block);
+        if (invalid_in_block && !invalid) {
+            first_invalid = indexed + first_in_block;
+        }
+        invalid += invalid_in_block;
+        indexed += lines;
+        blocks.push_back(Block(position - start, next_block - start, lines));
+        position = next_block;
+        if (_window > 0 && (position - released >= static_cast<ptrdiff_t>(RELEASE_BYTES) || position == end_of_range)) {
+            _original->release(released - start, position - released);
+            released = position;
+        }
+    }
+}
+
+const vector<PieceTable::Piece>& PieceTable::pieces(const size_t block) const {
+    Block& target = _blocks[block];
+    if (!target.loaded) {
+        target.pieces = make_shared<vector<Piece>>();
+        target.pieces->reserve(target.lines);
+        const char* const start = _original->data();
+        const char* const last = start + target.last_byte;
+        const char* position = start + target.first_byte;
+        // as many pieces as lines counted at load, even if the file was truncated since.
+        for (size_t i = 0; i < target.lines; ++i) {
+            const char* newline = static_cast<const char*>(memchr(position, '\n', last - position));
+            const char* end_of_line = newline ? newline : last;
+            target.pieces->push_back({static_cast<size_t>(position - start),
+                static_cast<size_t>(end_of_line - position), ORIGINAL});
+            position = min(end_of_line + 1, last);
+        }
+        target.loaded = true;
+        if (_window > 0) {
+            _recent.push_back(block);
+            // the block returned must stay loaded.
+            while (_recent.size() > _window) {
+                if (_recent.front() != block && _recent.front() < _blocks.size()) {
+                    unload(_recent.front());
+                }
+                _recent.pop_front();
+            }
+        }
+    }
+    return *target.pieces;
+}
+
+vector<PieceTable::Piece>& PieceTable::mutable_pieces(const size_t block) {
+    pieces(block);
+    Block& target = _blocks[block];
+    if (target.pieces.use_count() > 1) {
+        // a snapshot has it: it keeps the pieces as they are.
+        target.pieces = make_shared<vector<Piece>>(*target.pieces);
+    }
+    return *target.pieces;
+}
+
+void PieceTable::unload(const size_t block) const {
+    Block& target = _blocks[block];
+    if (!target.loaded || target.pieces->empty()) {
+        return;
+    }
+    const vector<Piece>& block_pieces = *target.pieces;
+    for (size_t i = 0; i < block_pieces.size(); ++i) {
+        if (block_pieces[i].source != ORIGINAL ||
+            (i > 0 && block_pieces[i].offset != block_pieces[i-1].offset + block_pieces[i-1].length + 1)) {
+            return;
+        }
+    }
+    const size_t first_byte = block_pieces.front().offset;
+    const size_t last_byte = min(block_pieces.back().offset + block_pieces.back().length + 1, _original->size());
+    target = Block(first_byte, last_byte, block_pieces.size());
+    _original->release(first_byte, last_byte - first_byte);
+}
+
+void PieceTable::update_prefix(const size_t from_block) {
+    _prefix.resize(_blocks.size());
+    for (size_t i = from_block; i < _blocks.size(); ++i) {
+        _prefix[i] = i ? (_prefix[i-1] + _blocks[i-1].size()) : 0;
+    }
+    _size = _blocks.empty() ? 0 : (_prefix.back() + _blocks.back().size());
+}
+
+void PieceTable::split_block(const size_t block, const size_t offset) {
+    if (offset == 0 || offset >= _blocks[block].size()) {
+        return;
+    }
+    vector<Piece>& head = mutable_pieces(block);
+    Block tail(vector<Piece>(next(begin(head), offset), end(head)));
+    head.erase(next(begin(head), offset), end(head));
+    _blocks.insert(next(begin(_blocks), block + 1), move(tail));
+}
+
+PieceTable::Piece PieceTable::add(const char* data, const size_t length) {
+    Piece piece = {_added.add(data, length), length, ADDED};
+    return piece;
+}
+
+const char* PieceTable::data(const Piece& piece) const {
+    return (piece.source == ORIGINAL) ? _original->data() + piece.offset : _added.data(piece.offset);
+}
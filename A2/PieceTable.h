@@ -0,0 +1,229 @@
+#ifndef PieceTable_h
+#define PieceTable_h
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+#include "LineArena.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+/**
+ * Buffer engine storing the original file bytes untouched plus
+ * an append-only buffer for every line added or changed afterwards.
+ * A line is a piece: a slice of one of those two buffers.
+ * The file is memory mapped, so lines are never copied on load.
+ *
+ * Pieces are kept in blocks of at most MAX_BLOCK_SIZE lines, and
+ * a prefix count of lines per block lets a line lookup binary search
+ * the right block, so finding a line is O(log n) and inserting or
+ * removing lines only moves pieces within a block.
+ *
+ * With a window, the table streams the file instead of holding it:
+ * only the last blocks loaded keep their pieces, and the ones still
+ * as they are in the file go back to being a byte range whose pages
+ * are dropped from memory. Edited blocks are kept, so memory is bounded
+ * by the window plus the edits.
+ */
+class PieceTable : public Buffer {
+private:
+    enum Source : unsigned char {
+        ORIGINAL,
+        ADDED
+    };
+
+    struct Piece {
+        size_t offset;
+        size_t length;
+        Source source;
+    };
+
+    /**
+     * A run of consecutive lines. Blocks created when loading a file
+     * only know their byte range and line count; their pieces are
+     * built the first time one of their lines is needed.
+     * The pieces are shared with the snapshots taken since they were
+     * built, and copied before being changed (see mutable_pieces).
+     */
+    struct Block {
+        shared_ptr<vector<Piece>> pieces;
+        size_t first_byte, last_byte;
+        size_t lines;
+        bool loaded;
+
+        Block();
+        Block(vector<Piece>&& pieces);
+        Block(const size_t first_byte, const size_t last_byte, const size_t lines);
+        size_t size() const;
+    };
+
+    /**
+     * Lines cut or copied from this buffer: only their pieces,
+     * the text stays where it is.
+     */
+    struct PieceLines : public Lines {
+        vector<Piece> pieces;
+
+        size_t size() const override;
+        size_t memory() const override;
+    };
+
+    /**
+     * Blocks above that size get split.
+     */
+    static const size_t MAX_BLOCK_SIZE = 1024;
+
+    /**
+     * Files are indexed by several threads when each one
+     * gets at least that many bytes.
+     */
+    static const size_t MIN_BYTES_PER_THREAD = 16 << 20;
+
+    /**
+     * With a window, the pages of the file are dropped each time
+     * that many bytes have been indexed.
+     */
+    static const size_t RELEASE_BYTES = 64 << 20;
+
+    /**
+     * The content of the file as it was loaded, shared with the snapshots.
+     */
+    shared_ptr<MappedFile> _original;
+
+    /**
+     * Every line inserted or changed, one after the other.
+     * Its copies in the snapshots share its slabs.
+     */
+    LineArena _added;
+
+    mutable vector<Block> _blocks;
+
+    /**
+     * _prefix[i] is the number of lines before _blocks[i].
+     */
+    vector<size_t> _prefix;
+
+    size_t _size;
+
+    /**
+     * Lines of the loaded file that are not valid UTF-8, and the first one.
+     */
+    size_t _invalid_lines, _first_invalid;
+
+    /**
+     * Maximum number of blocks loaded from the file, 0 for no limit.
+     */
+    const size_t _window;
+
+    /**
+     * The blocks loaded from the file, oldest first. Blocks inserted or
+     * removed since may have shifted the indices: unloading another
+     * block than intended is harmless, it only gets loaded again.
+     */
+    mutable deque<size_t> _recent;
+
+    /**
+     * Finds the block holding the line at the given index.
+     * Sets offset to the position of the line within that block.
+     */
+    size_t locate(const size_t index, size_t& offset) const;
+
+    /**
+     * Cuts the lines of _original in [first, last) into unloaded blocks,
+     * checking that they are valid UTF-8 on the way. Sets invalid to the
+     * number of lines that are not, and first_invalid to the first one
+     * (counted from first). first must be the start of a line.
+     */
+    void index_range(const size_t first, const size_t last, vector<Block>& blocks,
+                     size_t& invalid, size_t& first_invalid) const;
+
+    /**
+     * Returns the pieces of the given block, building them
+     * from the original file first if needed.
+     */
+    const vector<Piece>& pieces(const size_t block) const;
+
+    /**
+     * Returns the pieces of the given block to be changed,
+     * copying them first if a snapshot shares them.
+     */
+    vector<Piece>& mutable_pieces(const size_t block);
+
+    /**
+     * Turns the block back into a byte range of the file when its
+     * pieces are still the lines of the file as they were, and drops
+     * its pages from memory.
+     */
+    void unload(const size_t block) const;
+
+    /**
+     * Recomputes the prefix counts from the given block onward.
+     */
+    void update_prefix(const size_t from_block);
+
+    /**
+     * Splits the given block in two at the given offset.
+     * Nothing is done when the offset is at either end.
+     */
+    void split_block(const size_t block, const size_t offset);
+
+    /**
+     * Inserts the pieces before the given index.
+     */
+    void insert_pieces(const size_t index, const vector<Piece>& added);
+
+    /**
+     * Appends a line to the added buffer and returns its piece.
+     */
+    Piece add(const char* data, const size_t length);
+
+    const char* data(const Piece& piece) const;
+
+    /**
+     * Copies share everything but the block list (see snapshot).
+     */
+    PieceTable(const PieceTable&)=default;
+
+public:
+    /**
+     * Window size of the streaming mode, in blocks.
+     */
+    static const size_t WINDOW_BLOCKS = 64;
+
+    /**
+     * Keeps at most window blocks loaded from the file, or all of them when 0.
+     */
+    explicit PieceTable(const size_t window=0);
+    ~PieceTable()=default;
+
+    bool load(const string& filename) override;
+    size_t invalid_lines(size_t& first) const override;
+    bool truncated() override;
+    size_t size() const override;
+    string line(const size_t index) const override;
+    void for_each(const size_t from, const size_t to, const LineVisitor& visitor) const override;
+    void insert(const size_t index, const LineBatch& lines) override;
+    void replace(const size_t index, const string& line) override;
+    void erase(const size_t from, const size_t to) override;
+    unique_ptr<Lines> copy(const size_t from, const size_t to) const override;
+    unique_ptr<Lines> cut(const size_t from, const size_t to) override;
+    void insert(const size_t index, const Lines& lines) override;
+
+    /**
+     * Copies the block list only, in O(number of blocks): the pieces,
+     * the added lines and the mapped file are shared, and the pieces of a
+     * block are copied when it is next changed.
+     */
+    unique_ptr<Buffer> snapshot() const override;
+
+    /**
+     * Lines still as they are in the original file are copied
+     * from it in runs as long as possible.
+     */
+    void write_to(FileWriter& writer) const override;
+};
+
+#endif /* PieceTable_h */
@@ -0,0 +1,66 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "Buffer.h"
+#include "MappedFile.h"
+#include "NewlineScanner.h"
+#include "Utf8.h"
+
+using namespace std;
+
+/**
+ * Compares the time taken to open a file with the list buffer
+ * (getline, one string per line) and with the piece table
+ * (memory map and vectorized newline scan), along with the newline
+ * scan and UTF-8 validation alone.
+ * Usage: ./scan_bench file_name
+ */
+
+namespace {
+
+template <typename Function>
+double time_ms(Function function) {
+    auto start = chrono::steady_clock::now();
+    function();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void load(const string& filename, BufferType type, const char* name) {
+    unique_ptr<Buffer> buffer(Buffer::create(type));
+    size_t lines(0);
+    double ms = time_ms([&]() {
+        buffer->load(filename);
+        lines = buffer->size();
+    });
+    cout << name << "\t" << lines << " lines\t" << ms << " ms" << endl;
+}
+
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc != 2) {
+        cerr << "Usage: " << argv[0] << " file_name" << endl;
+        return EXIT_FAILURE;
+    }
+    const string filename(argv[1]);
+    MappedFile file;
+    if (!file.open(filename)) {
+        cerr << "Unable to open file " << filename << endl;
+        return EXIT_FAILURE;
+    }
+    size_t newlines(0);
+    double ms = time_ms([&]() {
+        newlines = NewlineScanner::count(file.data(), file.size());
+    });
+    cout << "scan (" << NewlineScanner::implementation() << ")\t" << newlines << " newlines\t" << ms << " ms" << endl;
+    size_t first, invalid(0);
+    ms = time_ms([&]() {
+        invalid = Utf8::invalid_lines(file.data(), file.data() + file.size(), first);
+    });
+    cout << "utf-8 (" << Utf8::implementation() << ")\t" << invalid << " invalid lines\t" << ms << " ms" << endl;
+    load(filename, PIECE_TABLE_BUFFER, "piece table");
+    load(filename, LIST_BUFFER, "read_lines");
+    return EXIT_SUCCESS;
+}
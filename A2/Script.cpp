@@ -0,0 +1,85 @@
+#include "Script.h"
+#include <atomic>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include "LineEditor.h"
+
+bool Script::load(istream& input, string& error) {
+    _steps.clear();
+    string line;
+    size_t line_number(0);
+    while (getline(input, line)) {
+        ++line_number;
+        Command command(1, 1);
+        if (!command.parse(line)) {
+            ostringstream oss;
+            oss << "line " << line_number << ": invalid command";
+            error = oss.str();
+            return false;
+        }
+        Step step = { command, "" };
+        if (command.getType() == APPEND || command.getType() == INSERT) {
+            bool terminated(false);
+            while (!terminated && getline(input, line)) {
+                ++line_number;
+                terminated = (line == ".");
+                step.input += line + "\n";
+            }
+        } else if (command.getType() == CHANGE
+                   || (command.getType() == GLOBAL && command.getGlobalType() == CHANGE)) {
+            for (int i = 0; i < 2 && getline(input, line); ++i) {
+                ++line_number;
+                step.input += line + "\n";
+            }
+        }
+        _steps.push_back(step);
+    }
+    return true;
+}
+
+const vector<Script::Step>& Script::steps() const {
+    return _steps;
+}
+
+int Script::apply(const vector<string>& filenames, BufferType buffer_type,
+                  const size_t parallel_threshold, const size_t undo_limit, const int compression_level,
+                  ostream& output) const {
+    struct Result {
+        string messages;
+        int status;
+    };
+    vector<Result> results(filenames.size());
+    atomic<size_t> next_file(0);
+    auto worker = [&]() {
+        for (size_t i = next_file++; i < filenames.size(); i = next_file++) {
+            ostringstream messages;
+            LineEditor editor(filenames[i], buffer_type, messages, messages);
+            editor.setParallelThreshold(parallel_threshold);
+            editor.setUndoLimit(undo_limit);
+            editor.setCompressionLevel(compression_level);
+            results[i].status = editor.runScript(*this);
+            results[i].messages = messages.str();
+        }
+    };
+    const size_t thread_count = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), filenames.size()));
+    vector<thread> workers;
+    for (size_t i = 1; i < thread_count; ++i) {
+        workers.push_back(thread(worker));
+    }
+    worker();
+    for (auto it = begin(workers); it != end(workers); ++it) {
+        it->join();
+    }
+
+    int status(EXIT_SUCCESS);
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        output << results[i].messages;
+        output << filenames[i] << ": " << (results[i].status == EXIT_SUCCESS ? "ok" : "failed") << "\n";
+        if (results[i].status != EXIT_SUCCESS) {
+            status = EXIT_FAILURE;
+        }
+    }
+    output.flush();
+    return status;
+}
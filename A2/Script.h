@@ -0,0 +1,55 @@
+#ifndef Script_h
+#define Script_h
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+#include "Command.h"
+
+using namespace std;
+
+/**
+ * A list of commands parsed once, to be run on any number of files
+ * without prompts (led -s script_file file...).
+ * The script has the same format as what would be typed in the editor:
+ * one command per line, followed by the text lines for 'a' and 'i'
+ * (ending with a line holding a single '.') and the two lines
+ * answering "Change what?" and "to what?" for 'c'.
+ */
+class Script {
+public:
+    /**
+     * A parsed command along with the text lines it reads,
+     * each one ending with a newline.
+     */
+    struct Step {
+        Command command;
+        string input;
+    };
+
+private:
+    vector<Step> _steps;
+
+public:
+    /**
+     * Parses all the commands from the given stream.
+     * Returns false and sets error if a command is invalid.
+     */
+    bool load(istream& input, string& error);
+
+    const vector<Step>& steps() const;
+
+    /**
+     * Runs the script on every file, several files at a time.
+     * Each file's messages are reported in order on the given
+     * stream, followed by its status. parallel_threshold, undo_limit
+     * and compression_level are passed on to each LineEditor.
+     * Returns EXIT_FAILURE if the script failed on any of the files.
+     */
+    int apply(const vector<string>& filenames, BufferType buffer_type,
+              const size_t parallel_threshold, const size_t undo_limit, const int compression_level,
+              ostream& output) const;
+};
+
+#endif /* Script_h */
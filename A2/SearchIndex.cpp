@@ -0,0 +1,238 @@
+#include "SearchIndex.h"
+#include "StringSearcher.h"
+
+const size_t SearchIndex::BLOCK_LINES;
+const size_t SearchIndex::FILTER_WORDS;
+
+namespace {
+
+const unsigned FILTER_BITS = 13; // 2^13 bits = FILTER_WORDS words of 64 bits.
+
+/**
+ * The two bits of a trigram in the filter.
+ */
+inline void trigram_bits(const unsigned char* data, uint64_t& first, uint64_t& second) {
+    const uint64_t trigram = (uint64_t(data[0]) << 16) | (uint64_t(data[1]) << 8) | data[2];
+    const uint64_t hash = trigram * 0x9E3779B97F4A7C15ull;
+    first = hash >> (64 - FILTER_BITS);
+    second = (hash >> 20) & ((1u << FILTER_BITS) - 1);
+}
+
+}
+
+SearchIndex::Block::Block(const size_t lines) : lines(lines), built(false) { }
+
+SearchIndex::SearchIndex() : _lines(0), _active(false), _hint_block(0), _hint_first(0) { }
+
+void SearchIndex::reset() {
+    _blocks.clear();
+    _lines = 0;
+    _active = false;
+    _hint_block = _hint_first = 0;
+}
+
+void SearchIndex::inserted(const size_t index, const LineBatch& lines) {
+    if (!_active || lines.empty()) {
+        return;
+    }
+    if (_blocks.empty()) {
+        _blocks.push_back(Block(0));
+    }
+    size_t offset;
+    const size_t block = locate(index, offset);
+    _blocks[block].lines += lines.size();
+    if (_blocks[block].built) {
+        for (size_t i = 0; i < lines.size(); ++i) {
+            add_trigrams(_blocks[block].filter, lines.data(i), lines.length(i));
+        }
+    }
+    _lines += lines.size();
+    split(block);
+}
+
+void SearchIndex::inserted(const size_t index, const size_t count) {
+    if (!_active || count == 0) {
+        return;
+    }
+    if (_blocks.empty()) {
+        _blocks.push_back(Block(0));
+    }
+    size_t offset;
+    const size_t block = locate(index, offset);
+    _blocks[block].lines += count;
+    _blocks[block].built = false;
+    _blocks[block].filter.clear();
+    _lines += count;
+    split(block);
+}
+
+void SearchIndex::removed(const size_t from, const size_t to) {
+    if (!_active || from >= to) {
+        return;
+    }
+    size_t offset;
+    size_t block = locate(from, offset);
+    size_t remaining = to - from;
+    while (remaining > 0) {
+        const size_t count = min(remaining, _blocks[block].lines - offset);
+        _blocks[block].lines -= count;
+        remaining -= count;
+        if (_blocks[block].lines == 0) {
+            _blocks.erase(begin(_blocks) + block);
+        } else {
+            ++block;
+        }
+        offset = 0;
+    }
+    _lines -= to - from;
+    if (_hint_block >= _blocks.size()) {
+        _hint_block = _hint_first = 0;
+    }
+}
+
+void SearchIndex::changed(const size_t index, const char* data, const size_t length) {
+    if (!_active) {
+        return;
+    }
+    size_t offset;
+    Block& block = _blocks[locate(index, offset)];
+    if (block.built) {
+        add_trigrams(block.filter, data, length);
+    }
+}
+
+bool SearchIndex::find(const Buffer& buffer, const string& text, const size_t start, const bool forward, size_t& found) {
+    if (!_active || _lines != buffer.size()) {
+        // no index yet (or it went out of sync): blocks are built as searched.
+        _blocks.clear();
+        for (size_t line = 0; line < buffer.size(); line += BLOCK_LINES) {
+            _blocks.push_back(Block(min(BLOCK_LINES, buffer.size() - line)));
+        }
+        _lines = buffer.size();
+        _active = true;
+        _hint_block = _hint_first = 0;
+    }
+    if (_lines == 0) {
+        return false;
+    }
+    const StringSearcher searcher(text);
+    if (forward) {
+        return search_range(buffer, start, _lines, text, searcher, true, found)
+            || search_range(buffer, 0, start, text, searcher, true, found);
+    }
+    return search_range(buffer, 0, start + 1, text, searcher, false, found)
+        || search_range(buffer, start + 1, _lines, text, searcher, false, found);
+}
+
+bool SearchIndex::search_range(const Buffer& buffer, const size_t from, const size_t to, const string& text,
+                               const StringSearcher& searcher, const bool forward, size_t& found) {
+    if (from >= to) {
+        return false;
+    }
+    size_t offset;
+    size_t block = locate(forward ? from : to - 1, offset);
+    size_t first_line = (forward ? from : to - 1) - offset;
+    while (true) {
+        const size_t last_line = first_line + _blocks[block].lines;
+        if (search_block(buffer, block, first_line, max(from, first_line), min(to, last_line),
+                         text, searcher, forward, found)) {
+            return true;
+        }
+        if (forward) {
+            if (last_line >= to) {
+                return false;
+            }
+            first_line = last_line;
+            ++block;
+        } else {
+            if (first_line <= from) {
+                return false;
+            }
+            --block;
+            first_line -= _blocks[block].lines;
+        }
+    }
+}
+
+bool SearchIndex::search_block(const Buffer& buffer, const size_t block, const size_t first_line,
+                               const size_t from, const size_t to, const string& text,
+                               const StringSearcher& searcher, const bool forward, size_t& found) {
+    Block& current = _blocks[block];
+    if (current.built && !may_contain(current.filter, text)) {
+        return false;
+    }
+    // a block seen for the first time is read whole to build its filter.
+    const bool build = !current.built;
+    if (build) {
+        current.filter.assign(FILTER_WORDS, 0);
+    }
+    const size_t first = build ? first_line : from;
+    const size_t last = build ? first_line + current.lines : to;
+    size_t line = first;
+    bool match = false;
+    buffer.for_each(first, last, [&](const char* data, size_t length) {
+        if (build) {
+            add_trigrams(current.filter, data, length);
+        }
+        if (line >= from && line < to && (!match || !forward)
+            && searcher.find(data, data + length) != data + length) {
+            found = line;
+            match = true;
+        }
+        ++line;
+    });
+    current.built = true;
+    return match;
+}
+
+void SearchIndex::add_trigrams(vector<uint64_t>& filter, const char* data, const size_t length) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    for (size_t i = 0; i + 3 <= length; ++i) {
+        uint64_t first, second;
+        trigram_bits(bytes + i, first, second);
+        filter[first >> 6] |= uint64_t(1) << (first & 63);
+        filter[second >> 6] |= uint64_t(1) << (second & 63);
+    }
+}
+
+bool SearchIndex::may_contain(const vector<uint64_t>& filter, const string& text) {
+    // texts shorter than a trigram can't be checked.
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    for (size_t i = 0; i + 3 <= text.size(); ++i) {
+        uint64_t first, second;
+        trigram_bits(bytes + i, first, second);
+        if (!(filter[first >> 6] & (uint64_t(1) << (first & 63)))
+            || !(filter[second >> 6] & (uint64_t(1) << (second & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t SearchIndex::locate(const size_t line, size_t& offset) const {
+    size_t block = _hint_block, first_line = _hint_first;
+    while (line < first_line) {
+        --block;
+        first_line -= _blocks[block].lines;
+    }
+    while (line >= first_line + _blocks[block].lines && block + 1 < _blocks.size()) {
+        first_line += _blocks[block].lines;
+        ++block;
+    }
+    _hint_block = block;
+    _hint_first = first_line;
+    offset = line - first_line;
+    return block;
+}
+
+void SearchIndex::split(const size_t block) {
+    const size_t lines = _blocks[block].lines;
+    if (lines <= 2 * BLOCK_LINES) {
+        return;
+    }
+    const size_t parts = lines / BLOCK_LINES;
+    Block part = _blocks[block];
+    part.lines = BLOCK_LINES;
+    _blocks[block].lines = lines - (parts - 1) * BLOCK_LINES;
+    _blocks.insert(begin(_blocks) + block, parts - 1, part);
+}
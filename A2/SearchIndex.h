@@ -0,0 +1,119 @@
+#ifndef SearchIndex_h
+#define SearchIndex_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+
+class StringSearcher;
+
+using namespace std;
+
+/**
+ * Finds the lines containing a text, skipping the parts of the buffer
+ * that can't contain it.
+ *
+ * The lines are grouped in blocks of about BLOCK_LINES lines, and each
+ * block has a bloom filter of the trigrams (3 byte sequences) of its
+ * lines. A block whose filter lacks one of the text's trigrams is skipped
+ * without reading its lines. Filters are built the first time a search
+ * goes through their block, and kept up to date as lines are inserted,
+ * removed or changed: added lines add their trigrams, removed ones leave
+ * theirs (a filter may claim more than the block holds, never less).
+ *
+ * The editor must report every change to the buffer, or call reset.
+ */
+class SearchIndex {
+private:
+    static const size_t BLOCK_LINES = 128;
+    static const size_t FILTER_WORDS = 128;
+
+    struct Block {
+        size_t lines;
+        bool built;
+        vector<uint64_t> filter;
+
+        Block(const size_t lines);
+    };
+
+    vector<Block> _blocks;
+    size_t _lines;
+
+    /**
+     * False until the first search: the index costs nothing if unused.
+     */
+    bool _active;
+
+    /**
+     * The block found by the last locate and its first line: lookups
+     * start from there, as edits and searches tend to stay close.
+     */
+    mutable size_t _hint_block, _hint_first;
+
+    static void add_trigrams(vector<uint64_t>& filter, const char* data, const size_t length);
+    static bool may_contain(const vector<uint64_t>& filter, const string& text);
+
+    /**
+     * Returns the block holding the line, and the line's offset in it.
+     * A line equal to the number of lines gives the last block.
+     */
+    size_t locate(const size_t line, size_t& offset) const;
+
+    /**
+     * Splits the block if it grew too big. The filter of a built
+     * block is copied to every part: it is still valid for each.
+     */
+    void split(const size_t block);
+
+    /**
+     * Searches the lines [from, to) of the block, which starts at
+     * first_line. Builds the block's filter if needed. Sets found to the
+     * first match (or the last, if not forward) and returns true if any.
+     */
+    bool search_block(const Buffer& buffer, const size_t block, const size_t first_line,
+                      const size_t from, const size_t to, const string& text,
+                      const StringSearcher& searcher, const bool forward, size_t& found);
+
+    /**
+     * Searches the lines [from, to), block by block, in the given direction.
+     */
+    bool search_range(const Buffer& buffer, const size_t from, const size_t to, const string& text,
+                      const StringSearcher& searcher, const bool forward, size_t& found);
+
+public:
+    SearchIndex();
+
+    /**
+     * Drops the index; it is rebuilt by the next searches.
+     */
+    void reset();
+
+    void inserted(const size_t index, const LineBatch& lines);
+
+    /**
+     * count lines were inserted at index without their text at hand
+     * (copied or moved): the filter of their block is built again
+     * by the next search going through it.
+     */
+    void inserted(const size_t index, const size_t count);
+
+    /**
+     * The lines [from, to) were removed.
+     */
+    void removed(const size_t from, const size_t to);
+
+    /**
+     * The line at index now holds the given text.
+     */
+    void changed(const size_t index, const char* data, const size_t length);
+
+    /**
+     * Looks for the first line containing text, starting at the line
+     * start and going forward (or backward), wrapping around at the end
+     * (or beginning) of the buffer. Sets found and returns true if any.
+     */
+    bool find(const Buffer& buffer, const string& text, const size_t start, const bool forward, size_t& found);
+};
+
+#endif /* SearchIndex_h */
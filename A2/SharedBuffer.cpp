@@ -0,0 +1,133 @@
+#include "SharedBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include "MappedFile.h"
+#include "Utf8.h"
+
+SharedBuffer::SharedBuffer(const shared_ptr<LineStore>& store) : _store(store),
+    _invalid_lines(0), _first_invalid(0) { }
+
+SharedBuffer::~SharedBuffer() {
+    release(0, _lines.size());
+}
+
+void SharedBuffer::release(const size_t from, const size_t to) {
+    for (size_t i = from; i < to; ++i) {
+        _store->release(_lines[i]);
+    }
+}
+
+bool SharedBuffer::load(const string& filename) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+    release(0, _lines.size());
+    _lines.clear();
+    const char* position = file.data();
+    const char* last = position + file.size();
+    _invalid_lines = Utf8::invalid_lines(position, last, _first_invalid);
+    while (position < last) {
+        const char* newline = static_cast<const char*>(memchr(position, '\n', last - position));
+        const char* end = newline ? newline : last;
+        _lines.push_back(_store->add(position, end - position));
+        position = end + 1;
+    }
+    return true;
+}
+
+size_t SharedBuffer::invalid_lines(size_t& first) const {
+    first = _first_invalid;
+    return _invalid_lines;
+}
+
+size_t SharedBuffer::size() const {
+    return _lines.size();
+}
+
+string SharedBuffer::line(const size_t index) const {
+    return string(_lines[index]->data(), _lines[index]->length());
+}
+
+void SharedBuffer::for_each(const size_t from, const size_t to, const LineVisitor& visitor) const {
+    for (size_t i = from; i < to; ++i) {
+        visitor(_lines[i]->data(), _lines[i]->length());
+    }
+}
+
+void SharedBuffer::insert(const size_t index, const LineBatch& lines) {
+    vector<LineStore::Line*> inserted;
+    inserted.reserve(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        inserted.push_back(_store->add(lines.data(i), lines.length(i)));
+    }
+    _lines.insert(begin(_lines) + index, begin(inserted), end(inserted));
+}
+
+void SharedBuffer::replace(const size_t index, const string& line) {
+    // added first: the line may be replaced by itself.
+    LineStore::Line* replacement = _store->add(line.data(), line.size());
+    _store->release(_lines[index]);
+    _lines[index] = replacement;
+}
+
+void SharedBuffer::erase(const size_t from, const size_t to) {
+    release(from, to);
+    _lines.erase(begin(_lines) + from, begin(_lines) + to);
+}
+
+unique_ptr<Buffer::Lines> SharedBuffer::copy(const size_t from, const size_t to) const {
+    unique_ptr<SharedLines> result(new SharedLines());
+    result->store = _store;
+    result->lines.assign(begin(_lines) + from, begin(_lines) + to);
+    result->bytes = 0;
+    for (auto it = begin(result->lines); it != end(result->lines); ++it) {
+        _store->retain(*it);
+        result->bytes += (*it)->length();
+    }
+    return move(result);
+}
+
+unique_ptr<Buffer::Lines> SharedBuffer::cut(const size_t from, const size_t to) {
+    // the references are moved, not taken again.
+    unique_ptr<SharedLines> result(new SharedLines());
+    result->store = _store;
+    result->lines.assign(begin(_lines) + from, begin(_lines) + to);
+    result->bytes = 0;
+    for (auto it = begin(result->lines); it != end(result->lines); ++it) {
+        result->bytes += (*it)->length();
+    }
+    _lines.erase(begin(_lines) + from, begin(_lines) + to);
+    return move(result);
+}
+
+void SharedBuffer::insert(const size_t index, const Lines& lines) {
+    const vector<LineStore::Line*>& inserted = static_cast<const SharedLines&>(lines).lines;
+    for (auto it = begin(inserted); it != end(inserted); ++it) {
+        _store->retain(*it);
+    }
+    _lines.insert(begin(_lines) + index, begin(inserted), end(inserted));
+}
+
+void SharedBuffer::move_lines(const size_t from, const size_t to, const size_t index) {
+    // only the pointers move, the lines keep their references.
+    if (index < from) {
+        rotate(begin(_lines) + index, begin(_lines) + from, begin(_lines) + to);
+    } else if (index > to) {
+        rotate(begin(_lines) + from, begin(_lines) + to, begin(_lines) + index);
+    }
+}
+
+SharedBuffer::SharedLines::~SharedLines() {
+    for (auto it = begin(lines); it != end(lines); ++it) {
+        store->release(*it);
+    }
+}
+
+size_t SharedBuffer::SharedLines::size() const {
+    return lines.size();
+}
+
+size_t SharedBuffer::SharedLines::memory() const {
+    return bytes + lines.size() * sizeof(LineStore::Line*);
+}
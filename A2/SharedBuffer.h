@@ -0,0 +1,71 @@
+#ifndef SharedBuffer_h
+#define SharedBuffer_h
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+#include "LineStore.h"
+
+using namespace std;
+
+/**
+ * Buffer engine for editing many files at once: the lines live in a
+ * LineStore shared with the other buffers, and the buffer only holds
+ * an array of pointers to them. A line found in several files (or
+ * several times in one) is stored once. The file is read whole when
+ * loaded and not kept open.
+ */
+class SharedBuffer : public Buffer {
+private:
+    shared_ptr<LineStore> _store;
+    vector<LineStore::Line*> _lines;
+
+    /**
+     * Lines of the loaded file that are not valid UTF-8, and the first one.
+     */
+    size_t _invalid_lines, _first_invalid;
+
+    /**
+     * Lines cut or copied from this buffer: they keep their
+     * references to the lines of the store.
+     */
+    struct SharedLines : public Lines {
+        shared_ptr<LineStore> store;
+        vector<LineStore::Line*> lines;
+        size_t bytes;
+
+        ~SharedLines();
+        size_t size() const override;
+        size_t memory() const override;
+    };
+
+    /**
+     * Releases the lines in [from, to), leaving their slots as they are.
+     */
+    void release(const size_t from, const size_t to);
+
+public:
+    /**
+     * Creates an empty buffer storing its lines in the given store.
+     */
+    SharedBuffer(const shared_ptr<LineStore>& store);
+    ~SharedBuffer();
+    SharedBuffer(const SharedBuffer&)=delete;
+    SharedBuffer& operator=(const SharedBuffer&)=delete;
+
+    bool load(const string& filename) override;
+    size_t invalid_lines(size_t& first) const override;
+    size_t size() const override;
+    string line(const size_t index) const override;
+    void for_each(const size_t from, const size_t to, const LineVisitor& visitor) const override;
+    void insert(const size_t index, const LineBatch& lines) override;
+    void replace(const size_t index, const string& line) override;
+    void erase(const size_t from, const size_t to) override;
+    unique_ptr<Lines> copy(const size_t from, const size_t to) const override;
+    unique_ptr<Lines> cut(const size_t from, const size_t to) override;
+    void insert(const size_t index, const Lines& lines) override;
+    void move_lines(const size_t from, const size_t to, const size_t index) override;
+};
+
+#endif /* SharedBuffer_h */
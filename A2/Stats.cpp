@@ -0,0 +1,269 @@
+#include "Stats.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "Command.h"
+
+#ifdef NO_STATS
+
+size_t Stats::allocations() {
+    return 0;
+}
+
+void Stats::report(ostream& output) {
+    output << "statistics are not compiled in (built with -DNO_STATS)" << endl;
+}
+
+void Stats::enableTrace() { }
+
+bool Stats::writeTrace(const string&) {
+    return false;
+}
+
+#else
+
+namespace {
+
+atomic<size_t> allocation_count(0);
+
+}
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, memory_order_relaxed);
+    void* pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+const size_t Stats::COMMAND_PROBES;
+const size_t Stats::RING_SAMPLES;
+const size_t Stats::BUCKETS;
+
+static_assert(INVALID < Stats::COMMAND_PROBES, "every command needs a probe");
+
+atomic<uint64_t> Stats::_counters[COUNTER_COUNT];
+
+struct Stats::Ring {
+    struct Sample {
+        uint64_t start;
+        uint64_t duration;
+        size_t probe;
+    };
+
+    /**
+     * The ring's number, as the thread id of its samples in the trace.
+     */
+    size_t thread;
+
+    uint64_t counts[PROBE_COUNT][BUCKETS];
+    uint64_t totals[PROBE_COUNT];
+    uint64_t maximums[PROBE_COUNT];
+
+    /**
+     * Only allocated when tracing. The last sample is at (recorded - 1) % RING_SAMPLES.
+     */
+    vector<Sample> samples;
+    size_t recorded;
+};
+
+namespace {
+
+mutex rings_mutex;
+vector<unique_ptr<Stats::Ring>> rings;
+vector<Stats::Ring*> free_rings;
+atomic<bool> tracing(false);
+
+/**
+ * Gives the ring of a thread back to the pool when the thread ends.
+ */
+struct ThreadRing {
+    Stats::Ring* ring;
+
+    ~ThreadRing() {
+        if (ring != nullptr) {
+            lock_guard<mutex> lock(rings_mutex);
+            free_rings.push_back(ring);
+        }
+    }
+};
+
+thread_local ThreadRing thread_ring = { nullptr };
+
+const char* command_name(const CommandType type) {
+    switch (type) {
+        case PRINT: return "print";
+        case QUIT: return "quit";
+        case WRITE: return "write";
+        case INSERT: return "insert";
+        case APPEND: return "append";
+        case REMOVE: return "remove";
+        case PRINT_CURRENT_LINE: return "current_line";
+        case PRINT_WITH_LINE_NUM: return "number";
+        case MOVE_UP: return "up";
+        case MOVE_DOWN: return "down";
+        case CHANGE: return "change";
+        case UNDO: return "undo";
+        case REDO: return "redo";
+        case GLOBAL: return "global";
+        case SEARCH_FORWARD: return "search";
+        case SEARCH_BACKWARD: return "search_back";
+        case STATS: return "stats";
+        case LIST_FILES: return "list_files";
+        case SWITCH_FILE: return "switch_file";
+        case NEXT_FILE: return "next_file";
+        case PREVIOUS_FILE: return "previous_file";
+        case COPY: return "copy";
+        case MOVE: return "move";
+        case JOIN: return "join";
+        case RELOAD: return "reload";
+        case INVALID: return "invalid";
+    }
+    return "command";
+}
+
+const char* probe_name(const size_t probe) {
+    switch (probe) {
+        case Stats::PARSE: return "parse";
+        case Stats::READ_LINES: return "read_lines";
+        case Stats::REPLACE_ALL: return "replace_all";
+        case Stats::LOAD: return "load";
+    }
+    return command_name(static_cast<CommandType>(probe));
+}
+
+}
+
+Stats::Ring& Stats::ring() {
+    if (thread_ring.ring == nullptr) {
+        lock_guard<mutex> lock(rings_mutex);
+        if (free_rings.empty()) {
+            // value-initialized: all counts start at zero.
+            rings.push_back(unique_ptr<Ring>(new Ring()));
+            rings.back()->thread = rings.size() - 1;
+            thread_ring.ring = rings.back().get();
+        } else {
+            thread_ring.ring = free_rings.back();
+            free_rings.pop_back();
+        }
+    }
+    return *thread_ring.ring;
+}
+
+size_t Stats::bucket(const uint64_t nanoseconds) {
+    if (nanoseconds < 8) {
+        return nanoseconds;
+    }
+    const int octave = 63 - __builtin_clzll(nanoseconds);
+    return 8 + (octave - 3) * 4 + ((nanoseconds >> (octave - 2)) & 3);
+}
+
+uint64_t Stats::bucket_limit(const size_t bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    const size_t octave = 3 + (bucket - 8) / 4;
+    const uint64_t first = (4 + (bucket - 8) % 4) << (octave - 2);
+    return first + (uint64_t(1) << (octave - 2)) - 1;
+}
+
+void Stats::record(const size_t probe, const uint64_t start, const uint64_t end) {
+    Ring& current = ring();
+    const uint64_t duration = end - start;
+    ++current.counts[probe][bucket(duration)];
+    current.totals[probe] += duration;
+    current.maximums[probe] = max(current.maximums[probe], duration);
+    if (tracing.load(memory_order_relaxed)) {
+        if (current.samples.empty()) {
+            current.samples.resize(RING_SAMPLES);
+        }
+        current.samples[current.recorded++ % RING_SAMPLES] = { start, duration, probe };
+    }
+}
+
+size_t Stats::allocations() {
+    return allocation_count.load(memory_order_relaxed);
+}
+
+void Stats::report(ostream& output) {
+    lock_guard<mutex> lock(rings_mutex);
+    output << left << setw(14) << "probe" << right << setw(10) << "count" << setw(14) << "total ms"
+           << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << endl;
+    output << fixed << setprecision(3);
+    for (size_t probe = 0; probe < PROBE_COUNT; ++probe) {
+        vector<uint64_t> counts(BUCKETS);
+        uint64_t count(0), total(0), maximum(0);
+        for (const unique_ptr<Ring>& ring : rings) {
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                counts[i] += ring->counts[probe][i];
+                count += ring->counts[probe][i];
+            }
+            total += ring->totals[probe];
+            maximum = max(maximum, ring->maximums[probe]);
+        }
+        if (count == 0) {
+            continue;
+        }
+        // a percentile is given as the upper bound of its bucket.
+        uint64_t percentiles[2] = { 0, 0 };
+        const uint64_t ranks[2] = { (count + 1) / 2, count - count / 100 };
+        for (size_t p = 0; p < 2; ++p) {
+            uint64_t seen(0);
+            size_t i(0);
+            while ((seen += counts[i]) < ranks[p]) {
+                ++i;
+            }
+            percentiles[p] = min(bucket_limit(i), maximum);
+        }
+        output << left << setw(14) << probe_name(probe) << right << setw(10) << count
+               << setw(14) << total / 1e6 << setw(12) << percentiles[0] / 1e3
+               << setw(12) << percentiles[1] / 1e3 << setw(12) << maximum / 1e3 << endl;
+    }
+    output.unsetf(ios::floatfield);
+    output << "bytes read: file " << _counters[FILE_READ] << ", input " << _counters[INPUT_READ] << endl;
+    output << "bytes written: file " << _counters[FILE_WRITTEN] << ", output " << _counters[OUTPUT_WRITTEN]
+           << ", journal " << _counters[JOURNAL_WRITTEN] << endl;
+    output << "allocations: " << allocations() << endl;
+}
+
+void Stats::enableTrace() {
+    tracing = true;
+}
+
+bool Stats::writeTrace(const string& filename) {
+    lock_guard<mutex> lock(rings_mutex);
+    ofstream file(filename);
+    // the times are in microseconds, from the first sample kept.
+    uint64_t origin(UINT64_MAX);
+    for (const unique_ptr<Ring>& ring : rings) {
+        for (size_t i = 0; i < min(ring->recorded, RING_SAMPLES); ++i) {
+            origin = min(origin, ring->samples[i].start);
+        }
+    }
+    file << "{\"traceEvents\":[";
+    bool first(true);
+    file << fixed << setprecision(3);
+    for (const unique_ptr<Ring>& ring : rings) {
+        for (size_t i = 0; i < min(ring->recorded, RING_SAMPLES); ++i) {
+            const Ring::Sample& sample = ring->samples[i];
+            file << (first ? "\n" : ",\n") << "{\"name\":\"" << probe_name(sample.probe)
+                 << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->thread
+                 << ",\"ts\":" << (sample.start - origin) / 1e3 << ",\"dur\":" << sample.duration / 1e3 << "}";
+            first = false;
+        }
+    }
+    file << "\n]}\n";
+    file.close();
+    return !file.fail();
+}
+
+#endif
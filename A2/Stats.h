@@ -0,0 +1,144 @@
+#ifndef Stats_h
+#define Stats_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+/**
+ * Counters and timers on the hot paths of the editor, printed by the
+ * :stats command.
+ *
+ * A Timer measures its own lifetime and adds it to the histogram of its
+ * probe. Each thread records in its own ring (taken from a pool, so the
+ * worker threads reuse the rings of those gone before), without locks.
+ * When tracing is on, the ring also keeps the last RING_SAMPLES samples
+ * of its thread, written as a Chrome trace by writeTrace.
+ *
+ * Building with -DNO_STATS compiles all of it out.
+ */
+class Stats {
+public:
+    /**
+     * Probes 0 to COMMAND_PROBES - 1 time the commands, by CommandType.
+     */
+    static const size_t COMMAND_PROBES = 32;
+
+    enum Probe {
+        PARSE = COMMAND_PROBES,
+        READ_LINES,
+        REPLACE_ALL,
+        LOAD,
+        PROBE_COUNT
+    };
+
+    enum Counter {
+        FILE_READ,
+        INPUT_READ,
+        FILE_WRITTEN,
+        OUTPUT_WRITTEN,
+        JOURNAL_WRITTEN,
+        COUNTER_COUNT
+    };
+
+    /**
+     * Records the time from its construction to its destruction.
+     */
+    class Timer {
+#ifndef NO_STATS
+    private:
+        const size_t _probe;
+        const uint64_t _start;
+#endif
+
+    public:
+        explicit Timer(const size_t probe);
+        ~Timer();
+        Timer(const Timer&)=delete;
+        Timer& operator=(const Timer&)=delete;
+    };
+
+#ifndef NO_STATS
+    /**
+     * The histograms and samples of a thread.
+     */
+    struct Ring;
+#endif
+
+    /**
+     * Adds bytes to the counter.
+     */
+    static void add(const Counter counter, const size_t bytes);
+
+    /**
+     * The number of allocations (operator new) made so far.
+     */
+    static size_t allocations();
+
+    /**
+     * Prints the count, total and p50/p99/max time of every probe used,
+     * then the counters.
+     */
+    static void report(ostream& output);
+
+    /**
+     * Starts keeping the samples for writeTrace.
+     */
+    static void enableTrace();
+
+    /**
+     * Writes the samples kept as a Chrome trace (JSON, to be opened in
+     * chrome://tracing or Perfetto). Returns false if it could not be written.
+     */
+    static bool writeTrace(const string& filename);
+
+private:
+#ifndef NO_STATS
+    static const size_t RING_SAMPLES = 1 << 16;
+
+    /**
+     * Histogram buckets: 8 exact ones, then 4 per power of 2.
+     */
+    static const size_t BUCKETS = 256;
+
+    static atomic<uint64_t> _counters[COUNTER_COUNT];
+
+    static uint64_t now();
+    static void record(const size_t probe, const uint64_t start, const uint64_t end);
+    static Ring& ring();
+    static size_t bucket(const uint64_t nanoseconds);
+    static uint64_t bucket_limit(const size_t bucket);
+#endif
+};
+
+#ifdef NO_STATS
+
+inline Stats::Timer::Timer(const size_t) { }
+
+inline Stats::Timer::~Timer() { }
+
+inline void Stats::add(const Counter, const size_t) { }
+
+#else
+
+inline Stats::Timer::Timer(const size_t probe) : _probe(probe), _start(now()) { }
+
+inline Stats::Timer::~Timer() {
+    record(_probe, _start, now());
+}
+
+inline void Stats::add(const Counter counter, const size_t bytes) {
+    _counters[counter].fetch_add(bytes, memory_order_relaxed);
+}
+
+inline uint64_t Stats::now() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
+
+#endif /* Stats_h */
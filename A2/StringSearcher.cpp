@@ -0,0 +1,157 @@
+#include "StringSearcher.h"
+#include <cstdint>
+#include <cstring>
+#include "Utf8.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STRING_SEARCHER_X86
+#endif
+
+namespace {
+
+typedef const char* (*FindFunction)(const char*, const char*, const char*, size_t);
+
+/**
+ * Finds a pattern of at least 2 characters the simple way:
+ * look for its first character, then compare the rest.
+ */
+const char* find_scalar(const char* begin, const char* end, const char* pattern, size_t length) {
+    while (static_cast<size_t>(end - begin) >= length) {
+        const char* candidate = static_cast<const char*>(memchr(begin, pattern[0], end - begin - length + 1));
+        if (!candidate) {
+            return end;
+        }
+        if (memcmp(candidate + 1, pattern + 1, length - 1) == 0) {
+            return candidate;
+        }
+        begin = candidate + 1;
+    }
+    return end;
+}
+
+#ifdef STRING_SEARCHER_X86
+
+/**
+ * Checks the candidates of a chunk: mask has a bit set for each
+ * position where both the first and last characters of the pattern match.
+ */
+inline const char* check_candidates(uint32_t mask, const char* position, const char* pattern, size_t length) {
+    while (mask) {
+        const char* candidate = position + __builtin_ctz(mask);
+        if (memcmp(candidate + 1, pattern + 1, length - 2) == 0) {
+            return candidate;
+        }
+        mask &= mask - 1;
+    }
+    return nullptr;
+}
+
+// The vector versions compare 16 or 32 positions at once against both the
+// first and the last character of the pattern, and only compare the middle
+// of the pattern where both match.
+
+__attribute__((target("sse2")))
+const char* find_sse2(const char* begin, const char* end, const char* pattern, size_t length) {
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[length - 1]);
+    const char* position = begin;
+    for (; end - position >= static_cast<ptrdiff_t>(length + 15); position += 16) {
+        const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position));
+        const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(position + length - 1));
+        const uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                              _mm_cmpeq_epi8(last, block_last)));
+        const char* found = check_candidates(mask, position, pattern, length);
+        if (found) {
+            return found;
+        }
+    }
+    return find_scalar(position, end, pattern, length);
+}
+
+__attribute__((target("avx2")))
+const char* find_avx2(const char* begin, const char* end, const char* pattern, size_t length) {
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[length - 1]);
+    const char* position = begin;
+    for (; end - position >= static_cast<ptrdiff_t>(length + 31); position += 32) {
+        const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(position));
+        const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(position + length - 1));
+        const uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                                    _mm256_cmpeq_epi8(last, block_last)));
+        const char* found = check_candidates(mask, position, pattern, length);
+        if (found) {
+            return found;
+        }
+    }
+    return find_scalar(position, end, pattern, length);
+}
+
+#endif
+
+FindFunction select_implementation() {
+#ifdef STRING_SEARCHER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return find_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return find_sse2;
+    }
+#endif
+    return find_scalar;
+}
+
+const FindFunction find_implementation = select_implementation();
+
+}
+
+StringSearcher::StringSearcher(const string& pattern) : _pattern(pattern),
+    _check_boundaries(Utf8::validate(pattern.data(), pattern.data() + pattern.size()) != pattern.data() + pattern.size()) { }
+
+const char* StringSearcher::find_from(const char* line, const char* position, const char* end) const {
+    const size_t length = _pattern.size();
+    while (length > 0 && static_cast<size_t>(end - position) >= length) {
+        const char* found;
+        if (length == 1) {
+            found = static_cast<const char*>(memchr(position, _pattern[0], end - position));
+            found = found ? found : end;
+        } else {
+            found = find_implementation(position, end, _pattern.data(), length);
+        }
+        // a valid pattern can only match whole characters.
+        if (!_check_boundaries || found == end
+            || (Utf8::boundary(line, end - line, found - line)
+                && Utf8::boundary(line, end - line, found + length - line))) {
+            return found;
+        }
+        position = found + 1;
+    }
+    return end;
+}
+
+const char* StringSearcher::find(const char* begin, const char* end) const {
+    return find_from(begin, begin, end);
+}
+
+bool StringSearcher::replace_all(const char* data, const size_t length, const string& replacement, string& output) const {
+    const char* const end = data + length;
+    const char* found = find(data, end);
+    if (found == end) {
+        return false;
+    }
+    output.clear();
+    const char* position = data;
+    do {
+        output.append(position, found - position);
+        output += replacement;
+        position = found + _pattern.size();
+        found = find_from(data, position, end);
+    } while (found != end);
+    output.append(position, end - position);
+    return true;
+}
+
+const string& StringSearcher::pattern() const {
+    return _pattern;
+}
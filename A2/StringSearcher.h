@@ -0,0 +1,53 @@
+#ifndef StringSearcher_h
+#define StringSearcher_h
+
+#include <string>
+
+using namespace std;
+
+/**
+ * Finds a fixed pattern in lines of text. Meant to be built once
+ * and reused for every line, like for the change command.
+ * Uses AVX2 or SSE2 when the processor supports it (checked once
+ * at runtime) to test many candidate positions at a time.
+ *
+ * Matches are whole UTF-8 characters: a pattern that is not valid
+ * UTF-8 (starting with a continuation byte, or ending with part of a
+ * character) is not found in the middle of a character.
+ */
+class StringSearcher {
+private:
+    const string _pattern;
+
+    /**
+     * Set when the pattern could match part of a character, so that
+     * the boundaries of its matches must be checked.
+     */
+    const bool _check_boundaries;
+
+    /**
+     * Returns the first occurrence of the pattern in [position, end),
+     * line being the start of the line holding them.
+     */
+    const char* find_from(const char* line, const char* position, const char* end) const;
+
+public:
+    StringSearcher(const string& pattern);
+
+    /**
+     * Returns the first occurrence of the pattern in the line [begin, end),
+     * or end if there is none (or if the pattern is empty).
+     */
+    const char* find(const char* begin, const char* end) const;
+
+    /**
+     * Replaces every occurrence of the pattern in the given line by
+     * replacement and stores the result in output, reusing its memory.
+     * Returns false, leaving output alone, if the pattern isn't found.
+     */
+    bool replace_all(const char* data, const size_t length, const string& replacement, string& output) const;
+
+    const string& pattern() const;
+};
+
+#endif /* StringSearcher_h */
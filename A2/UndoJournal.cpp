@@ -0,0 +1,127 @@
+#include "UndoJournal.h"
+
+UndoJournal::UndoJournal(const size_t limit) : _recording(false), _memory(0), _limit(limit) { }
+
+void UndoJournal::start(const size_t current) {
+    _group.edits.clear();
+    _group.current_before = current;
+    _group.memory = 0;
+    _recording = true;
+}
+
+void UndoJournal::record(const size_t index, unique_ptr<Buffer::Lines> removed, const size_t inserted) {
+    if (!_recording) {
+        return;
+    }
+    _group.memory += sizeof(Edit) + removed->memory();
+    _group.edits.push_back({ index, move(removed), inserted, 0 });
+}
+
+void UndoJournal::record_move(const size_t from, const size_t to, const size_t index) {
+    if (!_recording) {
+        return;
+    }
+    // kept as the move undoing it, like the lines removed by the other edits.
+    size_t moved_to(from), destination(index);
+    reverse_move(moved_to, to - from, destination);
+    _group.memory += sizeof(Edit);
+    _group.edits.push_back({ moved_to, nullptr, to - from, destination });
+}
+
+void UndoJournal::finish(const size_t current) {
+    _recording = false;
+    if (_group.edits.empty()) {
+        return;
+    }
+    for (auto it = begin(_redo); it != end(_redo); ++it) {
+        _memory -= it->memory;
+    }
+    _redo.clear();
+    _group.current_after = current;
+    _memory += _group.memory;
+    _undo.push_back(move(_group));
+    _group = Group();
+    enforce_limit(false);
+}
+
+bool UndoJournal::undo(Buffer& buffer, size_t& current) {
+    if (_undo.empty()) {
+        return false;
+    }
+    Group& group = _undo.back();
+    _memory -= group.memory;
+    swap_lines(group, buffer, true);
+    _memory += group.memory;
+    current = group.current_before;
+    _redo.push_back(move(group));
+    _undo.pop_back();
+    enforce_limit(true);
+    return true;
+}
+
+bool UndoJournal::redo(Buffer& buffer, size_t& current) {
+    if (_redo.empty()) {
+        return false;
+    }
+    Group& group = _redo.back();
+    _memory -= group.memory;
+    swap_lines(group, buffer, false);
+    _memory += group.memory;
+    current = group.current_after;
+    _undo.push_back(move(group));
+    _redo.pop_back();
+    enforce_limit(false);
+    return true;
+}
+
+void UndoJournal::clear() {
+    _undo.clear();
+    _redo.clear();
+    _group.edits.clear();
+    _recording = false;
+    _memory = 0;
+}
+
+void UndoJournal::setLimit(const size_t limit) {
+    _limit = limit;
+    enforce_limit(!_redo.empty() && _undo.empty());
+}
+
+void UndoJournal::swap_lines(Group& group, Buffer& buffer, bool reverse) {
+    group.memory = 0;
+    for (size_t i = 0; i < group.edits.size(); ++i) {
+        Edit& edit = group.edits[reverse ? group.edits.size() - 1 - i : i];
+        if (!edit.removed) {
+            buffer.move_lines(edit.index, edit.index + edit.inserted, edit.destination);
+            reverse_move(edit.index, edit.inserted, edit.destination);
+            group.memory += sizeof(Edit);
+            continue;
+        }
+        unique_ptr<Buffer::Lines> taken = buffer.cut(edit.index, edit.index + edit.inserted);
+        buffer.insert(edit.index, *edit.removed);
+        edit.inserted = edit.removed->size();
+        edit.removed = move(taken);
+        group.memory += sizeof(Edit) + edit.removed->memory();
+    }
+}
+
+void UndoJournal::reverse_move(size_t& index, const size_t count, size_t& destination) {
+    const size_t moved_to = destination > index ? destination - count : destination;
+    // before the line that followed them.
+    destination = moved_to < index ? index + count : index;
+    index = moved_to;
+}
+
+void UndoJournal::enforce_limit(const bool keep_redo) {
+    // The command just done or undone is always kept, even if it is over
+    // the limit on its own: its lines were already in memory anyway.
+    // redo is forgotten first, it is the least likely to be needed.
+    while (_memory > _limit && _redo.size() > (keep_redo ? 1 : 0)) {
+        _memory -= _redo.front().memory;
+        _redo.erase(begin(_redo));
+    }
+    while (_memory > _limit && _undo.size() > (keep_redo ? 0 : 1)) {
+        _memory -= _undo.front().memory;
+        _undo.pop_front();
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef UndoJournal_h
+#define UndoJournal_h
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include "Buffer.h"
+
+using namespace std;
+
+/**
+ * Keeps what is needed to undo and redo the commands that changed the
+ * buffer. Only the lines that changed are kept, as the buffer's own
+ * Buffer::Lines, so undoing a command costs as much as the command did.
+ * The oldest commands are forgotten when the memory limit is reached,
+ * but the last command can always be undone.
+ */
+class UndoJournal {
+private:
+    /**
+     * Lines [index, index + inserted) replaced the removed lines or, when
+     * removed is null, were moved before the line at destination
+     * (see Buffer::move_lines): nothing is kept for a move.
+     */
+    struct Edit {
+        size_t index;
+        unique_ptr<Buffer::Lines> removed;
+        size_t inserted;
+        size_t destination;
+    };
+
+    /**
+     * All the edits of one command, with the current line before and after.
+     */
+    struct Group {
+        vector<Edit> edits;
+        size_t current_before, current_after;
+        size_t memory;
+    };
+
+    deque<Group> _undo;
+    vector<Group> _redo;
+
+    /**
+     * The command being recorded.
+     */
+    Group _group;
+    bool _recording;
+
+    size_t _memory;
+    size_t _limit;
+
+    /**
+     * Swaps the lines of every edit of the group with the ones in the
+     * buffer, in reverse order when undoing. The group can then be
+     * applied again in the other direction.
+     */
+    static void swap_lines(Group& group, Buffer& buffer, bool reverse);
+
+    /**
+     * Turns the move of count lines from index to before destination
+     * into the one taking them back.
+     */
+    static void reverse_move(size_t& index, const size_t count, size_t& destination);
+
+    /**
+     * Forgets the oldest commands until the memory limit is respected,
+     * keeping the last one done, or the last one undone if keep_redo is set.
+     */
+    void enforce_limit(const bool keep_redo);
+
+public:
+    /**
+     * The journal uses at most limit bytes (approximately).
+     */
+    UndoJournal(const size_t limit);
+
+    /**
+     * Starts recording a command. current is the current line.
+     */
+    void start(const size_t current);
+
+    /**
+     * Records that the lines [index, index + inserted) were put in place of
+     * the removed ones. Edits must be recorded in the order they are made.
+     */
+    void record(const size_t index, unique_ptr<Buffer::Lines> removed, const size_t inserted);
+
+    /**
+     * Records that the lines [from, to) were moved before the line at index.
+     */
+    void record_move(const size_t from, const size_t to, const size_t index);
+
+    /**
+     * Ends the command. If it changed anything, it becomes the
+     * one to undo next and the commands undone so far are forgotten.
+     */
+    void finish(const size_t current);
+
+    /**
+     * Reverts the last command. Returns false if there is nothing to undo.
+     * current is set to the current line from before the command.
+     */
+    bool undo(Buffer& buffer, size_t& current);
+
+    /**
+     * Applies the last command undone again. Returns false if there
+     * is nothing to redo. current is set to the line after the command.
+     */
+    bool redo(Buffer& buffer, size_t& current);
+
+    /**
+     * Forgets every command, for when the buffer is loaded again.
+     */
+    void clear();
+
+    void setLimit(const size_t limit);
+};
+
+#endif /* UndoJournal_h */
@@ -0,0 +1,334 @@
+#include "Utf8.h"
+#include <cstdint>
+#include <cstring>
+#include "NewlineScanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86
+#endif
+
+namespace {
+
+typedef const char* (*ValidateFunction)(const char*, const char*);
+
+inline bool is_continuation(const unsigned char byte) {
+    return (byte & 0xC0) == 0x80;
+}
+
+/**
+ * Length of the valid character starting at position, 0 if the bytes
+ * there are not one (including when it is cut by last).
+ */
+size_t sequence_length(const unsigned char* position, const unsigned char* last) {
+    const unsigned char lead = *position;
+    if (lead < 0x80) {
+        return 1;
+    }
+    size_t length;
+    // the second byte is further restricted for the leads that could
+    // start an overlong form, a surrogate or a code point above U+10FFFF.
+    unsigned char low = 0x80, high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        if (lead == 0xE0) {
+            low = 0xA0;
+        } else if (lead == 0xED) {
+            high = 0x9F;
+        }
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        if (lead == 0xF0) {
+            low = 0x90;
+        } else if (lead == 0xF4) {
+            high = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+    if (static_cast<size_t>(last - position) < length || position[1] < low || position[1] > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; ++i) {
+        if (!is_continuation(position[i])) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+const char* validate_scalar(const char* position, const char* last) {
+    const unsigned char* current = reinterpret_cast<const unsigned char*>(position);
+    const unsigned char* const end = reinterpret_cast<const unsigned char*>(last);
+    while (current < end) {
+        if (end - current >= 8) {
+            uint64_t word;
+            memcpy(&word, current, sizeof(word));
+            if (!(word & 0x8080808080808080ULL)) {
+                current += 8;
+                continue;
+            }
+        }
+        const size_t length = sequence_length(current, end);
+        if (!length) {
+            return reinterpret_cast<const char*>(current);
+        }
+        current += length;
+    }
+    return last;
+}
+
+#ifdef UTF8_X86
+
+/**
+ * Finishes with the scalar version from block on, the bytes before it
+ * being valid: it starts again from the lead byte of the character
+ * holding block, if block is within one.
+ */
+const char* validate_from(const char* position, const char* block, const char* last) {
+    const char* start = block;
+    for (size_t back = 1; back <= 3 && back <= static_cast<size_t>(block - position); ++back) {
+        if (!is_continuation(block[-back])) {
+            start = block - back;
+            break;
+        }
+    }
+    return validate_scalar(start, last);
+}
+
+// Error classes of the lookup tables: each byte is checked along with
+// the byte before it, the tables telling which errors the high and low
+// nibbles of the previous byte and the high nibble of the byte allow.
+// A byte is in error when all three agree.
+const uint8_t TOO_SHORT = 1 << 0;      // a lead not followed by a continuation
+const uint8_t TOO_LONG = 1 << 1;       // a continuation after an ASCII byte
+const uint8_t OVERLONG_3 = 1 << 2;     // E0 80..9F
+const uint8_t TOO_LARGE = 1 << 3;      // F4 90..BF, F5..FF
+const uint8_t SURROGATE = 1 << 4;      // ED A0..BF
+const uint8_t OVERLONG_2 = 1 << 5;     // C0, C1
+const uint8_t TOO_LARGE_1000 = 1 << 6; // F5..FF 80..8F
+const uint8_t OVERLONG_4 = 1 << 6;     // F0 80..8F
+const uint8_t TWO_CONTS = 1 << 7;      // two continuations, fine within a 3 or 4 byte character
+const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+const uint8_t BYTE_1_HIGH[16] = {
+    // 0xxx: ASCII
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    // 10xx: continuation
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    // 1100, 1101: lead of 2
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    // 1110: lead of 3
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    // 1111: lead of 4
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+const uint8_t BYTE_1_LOW[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+const uint8_t BYTE_2_HIGH[16] = {
+    // 0xxx: ASCII
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    // 1000, 1001, 101x: continuation
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    // 11xx: lead
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+/**
+ * The lookup tables and constants of the vector versions, loaded once
+ * per call rather than once per block.
+ */
+struct TablesSsse3 {
+    __m128i byte_1_high, byte_1_low, byte_2_high;
+    __m128i low_nibble, third_lead, fourth_lead, high_bit;
+};
+
+struct TablesAvx2 {
+    __m256i byte_1_high, byte_1_low, byte_2_high;
+    __m256i low_nibble, third_lead, fourth_lead, high_bit;
+};
+
+__attribute__((target("ssse3")))
+TablesSsse3 tables_ssse3() {
+    return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE_1_HIGH)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE_1_LOW)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE_2_HIGH)),
+            _mm_set1_epi8(0x0F),
+            _mm_set1_epi8(static_cast<char>(0xE0 - 0x80)),
+            _mm_set1_epi8(static_cast<char>(0xF0 - 0x80)),
+            _mm_set1_epi8(static_cast<char>(0x80))};
+}
+
+__attribute__((target("ssse3")))
+inline __m128i errors_ssse3(const TablesSsse3& tables, const __m128i input, const __m128i previous) {
+    const __m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+    const __m128i byte_1_high = _mm_shuffle_epi8(tables.byte_1_high,
+                                                 _mm_and_si128(_mm_srli_epi16(prev1, 4), tables.low_nibble));
+    const __m128i byte_1_low = _mm_shuffle_epi8(tables.byte_1_low, _mm_and_si128(prev1, tables.low_nibble));
+    const __m128i byte_2_high = _mm_shuffle_epi8(tables.byte_2_high,
+                                                 _mm_and_si128(_mm_srli_epi16(input, 4), tables.low_nibble));
+    const __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+    // two continuations in a row must be the third or fourth byte of a character.
+    const __m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 14), tables.third_lead);
+    const __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 13), tables.fourth_lead);
+    return _mm_xor_si128(_mm_and_si128(_mm_or_si128(third, fourth), tables.high_bit), special);
+}
+
+__attribute__((target("ssse3")))
+const char* validate_ssse3(const char* position, const char* last) {
+    const TablesSsse3 tables = tables_ssse3();
+    const char* block = position;
+    __m128i previous = _mm_setzero_si128();
+    for (; last - block >= 16; block += 16) {
+        const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+        // nothing to check when both blocks are ASCII.
+        if (_mm_movemask_epi8(_mm_or_si128(input, previous))) {
+            const __m128i errors = errors_ssse3(tables, input, previous);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(errors, _mm_setzero_si128())) != 0xFFFF) {
+                break;
+            }
+        }
+        previous = input;
+    }
+    return validate_from(position, block, last);
+}
+
+__attribute__((target("avx2")))
+TablesAvx2 tables_avx2() {
+    return {_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE_1_HIGH))),
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE_1_LOW))),
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(BYTE_2_HIGH))),
+            _mm256_set1_epi8(0x0F),
+            _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)),
+            _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)),
+            _mm256_set1_epi8(static_cast<char>(0x80))};
+}
+
+__attribute__((target("avx2")))
+inline __m256i errors_avx2(const TablesAvx2& tables, const __m256i input, const __m256i previous) {
+    // the last bytes of previous followed by the first ones of input.
+    const __m256i carried = _mm256_permute2x128_si256(previous, input, 0x21);
+    const __m256i prev1 = _mm256_alignr_epi8(input, carried, 15);
+    const __m256i byte_1_high = _mm256_shuffle_epi8(tables.byte_1_high,
+                                                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), tables.low_nibble));
+    const __m256i byte_1_low = _mm256_shuffle_epi8(tables.byte_1_low, _mm256_and_si256(prev1, tables.low_nibble));
+    const __m256i byte_2_high = _mm256_shuffle_epi8(tables.byte_2_high,
+                                                    _mm256_and_si256(_mm256_srli_epi16(input, 4), tables.low_nibble));
+    const __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    const __m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(input, carried, 14), tables.third_lead);
+    const __m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(input, carried, 13), tables.fourth_lead);
+    return _mm256_xor_si256(_mm256_and_si256(_mm256_or_si256(third, fourth), tables.high_bit), special);
+}
+
+__attribute__((target("avx2")))
+const char* validate_avx2(const char* position, const char* last) {
+    const TablesAvx2 tables = tables_avx2();
+    const char* block = position;
+    __m256i previous = _mm256_setzero_si256();
+    for (; last - block >= 32; block += 32) {
+        const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+        if (_mm256_movemask_epi8(_mm256_or_si256(input, previous))) {
+            const __m256i errors = errors_avx2(tables, input, previous);
+            if (!_mm256_testz_si256(errors, errors)) {
+                break;
+            }
+        }
+        previous = input;
+    }
+    return validate_from(position, block, last);
+}
+
+#endif
+
+const char* implementation_name("scalar");
+
+ValidateFunction select_implementation() {
+#ifdef UTF8_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        implementation_name = "avx2";
+        return validate_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        implementation_name = "ssse3";
+        return validate_ssse3;
+    }
+#endif
+    return validate_scalar;
+}
+
+const ValidateFunction validate_implementation = select_implementation();
+
+}
+
+const char* Utf8::validate(const char* position, const char* last) {
+    return validate_implementation(position, last);
+}
+
+size_t Utf8::invalid_lines(const char* data, const char* last, size_t& first) {
+    size_t count(0), line(0);
+    const char* position = data;
+    while (position < last) {
+        const char* invalid = validate_implementation(position, last);
+        if (invalid == last) {
+            break;
+        }
+        line += NewlineScanner::count(position, invalid - position);
+        if (count++ == 0) {
+            first = line;
+        }
+        // the rest of that line doesn't matter, go on from the next one.
+        size_t lines(1);
+        position = NewlineScanner::skip(invalid, last, lines);
+        if (!lines) {
+            break;
+        }
+        ++line;
+    }
+    return count;
+}
+
+bool Utf8::boundary(const char* data, const size_t size, const size_t offset) {
+    if (offset == 0 || offset >= size) {
+        return true;
+    }
+    const unsigned char* const bytes = reinterpret_cast<const unsigned char*>(data);
+    if (!is_continuation(bytes[offset])) {
+        return true;
+    }
+    // within a character only if a valid one starts before and reaches past offset.
+    for (size_t back = 1; back <= 3 && back <= offset; ++back) {
+        if (!is_continuation(bytes[offset - back])) {
+            return sequence_length(bytes + offset - back, bytes + size) <= back;
+        }
+    }
+    return true;
+}
+
+const char* Utf8::implementation() {
+    return implementation_name;
+}
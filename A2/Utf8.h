@@ -0,0 +1,45 @@
+#ifndef Utf8_h
+#define Utf8_h
+
+#include <cstddef>
+
+/**
+ * Checks and measures UTF-8 text. Validation uses AVX2 or SSSE3 when
+ * the processor supports it (checked once at runtime), classifying
+ * every byte with the two bytes before it through small lookup tables,
+ * so whole files are checked about as fast as they are read.
+ *
+ * Bytes that are not part of a valid character (a stray continuation
+ * byte, a truncated or overlong sequence, a surrogate...) are single
+ * units of their own everywhere.
+ */
+class Utf8 {
+public:
+    Utf8()=delete;
+
+    /**
+     * Returns the start of the first byte sequence in [position, last)
+     * that is not a valid character, or last if they all are.
+     */
+    static const char* validate(const char* position, const char* last);
+
+    /**
+     * Returns the number of lines in [data, last) holding bytes that
+     * are not valid UTF-8. When there is any, first is set to the index
+     * of the first one (0 being the line at data).
+     */
+    static size_t invalid_lines(const char* data, const char* last, size_t& first);
+
+    /**
+     * Whether the given offset of the text falls between two characters
+     * rather than within one. Both ends of the text are boundaries.
+     */
+    static bool boundary(const char* data, const size_t size, const size_t offset);
+
+    /**
+     * Name of the validator picked for this processor.
+     */
+    static const char* implementation();
+};
+
+#endif /* Utf8_h */
@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "Buffer.h"
+#include "FileWriter.h"
+#include "LineBatch.h"
+
+using namespace std;
+
+/**
+ * Checks that writing a file over the one a buffer was loaded from
+ * leaves the buffer's lines intact, with every engine, for a file that
+ * has another hard link: the buffer may still read from a mapping of
+ * it, which must not be rewritten in place. The file shrinks, which
+ * would make those reads fault if it were.
+ * Usage: ./write_check
+ */
+
+namespace {
+
+const size_t LINES = 50000;
+
+string read_file(const string& filename) {
+    ifstream file(filename, ios::binary);
+    ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+bool check(BufferType type, const char* name, const string& directory) {
+    const string filename = directory + "/file.txt";
+    const string link_name = directory + "/link.txt";
+    vector<string> expected;
+    string original;
+    for (size_t i = 0; i < LINES; ++i) {
+        expected.push_back("line " + to_string(i));
+        original += expected.back() + '\n';
+    }
+    ofstream(filename, ios::binary) << original;
+    if (link(filename.c_str(), link_name.c_str()) != 0) {
+        cout << name << ": could not link " << filename << endl;
+        return false;
+    }
+
+    unique_ptr<Buffer> buffer(Buffer::create(type));
+    bool passed = buffer->load(filename);
+    // keep the first and last lines, drop most of the middle.
+    buffer->erase(10, LINES - 10);
+    expected.erase(expected.begin() + 10, expected.end() - 10);
+    LineBatch added;
+    added.push_back("added");
+    buffer->insert(5, added);
+    expected.insert(expected.begin() + 5, "added");
+    FileWriter writer;
+    passed = passed && writer.open(filename);
+    if (passed) {
+        buffer->write_to(writer);
+        passed = writer.commit();
+    }
+    if (!passed) {
+        cout << name << ": could not load or write " << filename << endl;
+    }
+
+    string written;
+    for (size_t i = 0; i < buffer->size(); ++i) {
+        if (i >= expected.size() || buffer->line(i) != expected[i]) {
+            cout << name << ": line " << i + 1 << " of the buffer changed after writing" << endl;
+            passed = false;
+            break;
+        }
+        written += expected[i] + '\n';
+    }
+    if (buffer->size() != expected.size()) {
+        cout << name << ": " << buffer->size() << " lines in the buffer, " << expected.size() << " expected" << endl;
+        passed = false;
+    }
+    if (read_file(filename) != written) {
+        cout << name << ": " << filename << " does not hold the buffer" << endl;
+        passed = false;
+    }
+    if (read_file(link_name) != original) {
+        cout << name << ": " << link_name << " lost its content" << endl;
+        passed = false;
+    }
+    buffer.reset();
+    unlink(filename.c_str());
+    unlink(link_name.c_str());
+    return passed;
+}
+
+}
+
+int main() {
+    char directory[] = "/tmp/write_check.XXXXXX";
+    if (!mkdtemp(directory)) {
+        cerr << "Could not create a directory in /tmp." << endl;
+        return EXIT_FAILURE;
+    }
+    bool passed = check(LIST_BUFFER, "list buffer", directory);
+    passed = check(PIECE_TABLE_BUFFER, "piece table", directory) && passed;
+    passed = check(SHARED_BUFFER, "shared buffer", directory) && passed;
+    passed = check(WINDOWED_BUFFER, "windowed piece table", directory) && passed;
+    rmdir(directory);
+    cout << (passed ? "written files keep the buffers intact" : "FAILED") << endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,33 +1,123 @@
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <vector>
 #include <cstdlib>
+#include "Compression.h"
 #include "LineEditor.h"
+#include "Script.h"
+#include "Stats.h"
 
 using namespace std;
 
+namespace {
+
+/**
+ * Writes the trace if one was asked for, and returns the exit status
+ * (a failure if it could not be written).
+ */
+int write_trace(const string& filename, const int status) {
+    if (filename.empty()) {
+        return status;
+    }
+    if (!Stats::writeTrace(filename)) {
+        cerr << "Unable to write trace " << filename << endl;
+        return EXIT_FAILURE;
+    }
+    return status;
+}
+
+}
+
 int main(int argc, const char * argv[]) {
 
-    string filename;
-    int ret(EXIT_SUCCESS);
-    switch (argc) {
-        case 1:
-            cerr << "No filename given." << endl;
-            ret = EXIT_FAILURE;
-            break;
-        case 2:
-            {
-                // LineEditor exits in case of failure
-                // or when the user inputs the quit command.
-                filename = argv[1];
-                LineEditor ed(filename);
-                ed.run();
+    BufferType buffer_type(PIECE_TABLE_BUFFER);
+    size_t parallel_threshold(LineEditor::DEFAULT_PARALLEL_THRESHOLD);
+    size_t undo_limit(LineEditor::DEFAULT_UNDO_LIMIT);
+    int compression_level(Compression::DEFAULT_LEVEL);
+    string script_filename;
+    string trace_filename;
+    vector<string> filenames;
+    for (int i = 1; i < argc; ++i) {
+        const string argument(argv[i]);
+        if (argument == "-l") {
+            // use the list buffer engine instead of the piece table.
+            buffer_type = LIST_BUFFER;
+        } else if (argument == "-w") {
+            // stream the file: only a window of its lines stays in memory.
+            buffer_type = WINDOWED_BUFFER;
+        } else if (argument == "-s") {
+            if (++i == argc) {
+                cerr << "No script given." << endl;
+                return EXIT_FAILURE;
+            }
+            script_filename = argv[i];
+        } else if (argument == "-t") {
+            // number of lines from which 'c' runs on all cores.
+            char* end(nullptr);
+            if (++i == argc || (parallel_threshold = strtoul(argv[i], &end, 10), *end != '\0')) {
+                cerr << "-t expects a number of lines." << endl;
+                return EXIT_FAILURE;
+            }
+        } else if (argument == "-u") {
+            // megabytes kept for undoing commands.
+            char* end(nullptr);
+            if (++i == argc || (undo_limit = strtoul(argv[i], &end, 10) << 20, *end != '\0')) {
+                cerr << "-u expects a number of megabytes." << endl;
+                return EXIT_FAILURE;
             }
-            break;
-        default:
-            cerr << "Too many arguments." << endl;
-            ret = EXIT_FAILURE;
-            break;
+        } else if (argument == "-z") {
+            // level at which .gz and .zst files are written.
+            char* end(nullptr);
+            if (++i == argc || (compression_level = strtol(argv[i], &end, 10), *end != '\0')) {
+                cerr << "-z expects a compression level." << endl;
+                return EXIT_FAILURE;
+            }
+        } else if (argument == "-T") {
+            // Chrome trace of the timed sections, written at exit.
+            if (++i == argc) {
+                cerr << "No trace file given." << endl;
+                return EXIT_FAILURE;
+            }
+            trace_filename = argv[i];
+            Stats::enableTrace();
+        } else if (argument.size() > 1 && argument[0] == '-') {
+            cerr << "Unknown option " << argument << endl;
+            return EXIT_FAILURE;
+        } else {
+            filenames.push_back(argument);
+        }
+    }
+
+    if (filenames.empty()) {
+        cerr << "No filename given." << endl;
+        return EXIT_FAILURE;
     }
 
-    return ret;
+    if (script_filename.empty()) {
+        if (filenames.size() > 1 && buffer_type == PIECE_TABLE_BUFFER) {
+            // the files share their lines: identical lines are stored once.
+            buffer_type = SHARED_BUFFER;
+        }
+        // run returns when the user inputs the quit command.
+        LineEditor ed(filenames, buffer_type);
+        ed.setParallelThreshold(parallel_threshold);
+        ed.setUndoLimit(undo_limit);
+        ed.setCompressionLevel(compression_level);
+        return write_trace(trace_filename, ed.run());
+    }
+
+    ifstream script_file(script_filename);
+    if (!script_file) {
+        cerr << "Unable to open script " << script_filename << endl;
+        return EXIT_FAILURE;
+    }
+    Script script;
+    string error;
+    if (!script.load(script_file, error)) {
+        cerr << script_filename << ": " << error << endl;
+        return EXIT_FAILURE;
+    }
+    return write_trace(trace_filename, script.apply(filenames, buffer_type, parallel_threshold, undo_limit,
+                                                    compression_level, cout));
 }